@@ -0,0 +1,134 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_BOUNDED_QUEUE_HPP
+#define CHIPSIE_BOUNDED_QUEUE_HPP
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Blocking FIFO between threads with a fixed capacity, so a slow consumer
+// pushes back on its producers instead of piling up memory. Items move in
+// batches to keep the locking off the per item cost.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t max_items) {
+        capacity = max_items;
+        closed = false;
+    }
+
+    // Blocks while the queue is full. Returns false, dropping the item,
+    // once the queue is closed.
+    bool Push(T &&item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [this]() {
+            return items.size() < capacity || closed;
+        });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        guard.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Never blocks. Returns false, leaving item as it was, if the queue is
+    // full or closed.
+    bool TryPush(T &&item) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (items.size() >= capacity || closed) return false;
+        items.push_back(std::move(item));
+        guard.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Moves all of batch in, waiting for room as often as needed
+    bool PushBatch(std::vector<T> *batch) {
+        size_t next = 0;
+        while (next < batch->size()) {
+            std::unique_lock<std::mutex> guard(lock);
+            not_full.wait(guard, [this]() {
+                return items.size() < capacity || closed;
+            });
+            if (closed) break;
+            while (next < batch->size() && items.size() < capacity) {
+                items.push_back(std::move((*batch)[next++]));
+            }
+            guard.unlock();
+            not_empty.notify_one();
+        }
+        bool pushed_all = next == batch->size();
+        batch->clear();
+        return pushed_all;
+    }
+
+    // Blocks until there is at least one item and takes up to max_items.
+    // Returns false once the queue is closed.
+    bool PopBatch(std::vector<T> *batch, size_t max_items, 
+        size_t *out_depth = NULL) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [this]() {
+            return !items.empty() || closed;
+        });
+        if (closed) return false;
+        if (out_depth != NULL) *out_depth = items.size();
+        while (!items.empty() && batch->size() < max_items) {
+            batch->push_back(std::move(items.front()));
+            items.pop_front();
+        }
+        guard.unlock();
+        not_full.notify_all();
+        return true;
+    }
+
+    size_t GetDepth() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return items.size();
+    }
+
+    // Wakes everyone up and drops whatever is still queued
+    void Close() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+            items.clear();
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    mutable std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+};
+
+#endif // CHIPSIE_BOUNDED_QUEUE_HPP
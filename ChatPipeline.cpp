@@ -0,0 +1,331 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ChatPipeline.hpp"
+#include "EventLoop.hpp"
+#include <stdio.h>
+
+static const char * const STAGE_NAMES[] = {
+    "recv", "parse", "filter", "dispatch", "render", "send"
+};
+
+ChatPipeline::ChatPipeline() : parse_queue(QUEUE_SIZE), 
+    filter_queue(QUEUE_SIZE), render_queue(QUEUE_SIZE), 
+    send_queue(QUEUE_SIZE) {
+    tc = NULL;
+    db = NULL;
+    motd = NULL;
+    dispatch_depth = 0;
+    shedding = false;
+    shed_count = 0;
+    expired_dispatch_count = 0;
+    expired_send_count = 0;
+    dropped_reply_count = 0;
+    parsed_count = 0;
+    stats_start_ms = 0;
+    for (int i = 0; i < NUM_STAGES; i++) {
+        stats[i].msg_count = 0;
+        stats[i].batch_count = 0;
+        stats[i].busy_us = 0;
+        stats[i].max_depth = 0;
+    }
+}
+
+bool ChatPipeline::Start(TwitchConn *twitch_conn, Database *database, 
+    MotdEngine *motd_engine, EventLoop *loop, int num_workers) {
+    tc = twitch_conn;
+    db = database;
+    motd = motd_engine;
+    if (!dispatch_pool.Start(num_workers)) return false;
+    if (!cmds.Init(loop, &dispatch_pool, db, 
+        [this](const std::string &chan, const std::string &text, 
+            std::function<void()> &&on_sent) {
+        Say(chan, text, std::move(on_sent));
+    })) {
+        dispatch_pool.Shutdown();
+        return false;
+    }
+
+    stats_start_ms = EventLoop::NowMs();
+    stage_threads.emplace_back(&ChatPipeline::RunStage, this, STAGE_PARSE, 
+        &parse_queue);
+    stage_threads.emplace_back(&ChatPipeline::RunStage, this, STAGE_FILTER, 
+        &filter_queue);
+    stage_threads.emplace_back(&ChatPipeline::RunStage, this, STAGE_RENDER, 
+        &render_queue);
+    stage_threads.emplace_back(&ChatPipeline::RunStage, this, STAGE_SEND, 
+        &send_queue);
+    return true;
+}
+
+void ChatPipeline::Submit(std::string_view line, uint64_t arrival_us) {
+    uint64_t start_us = EventLoop::NowUs();
+    ChatMsgPtr msg = std::make_shared<ChatMsg>();
+    msg->line = std::string(line);
+    msg->arrival_us = arrival_us;
+    recv_batch.push_back(std::move(msg));
+
+    StageStats &recv = stats[STAGE_RECV];
+    uint64_t service_us = EventLoop::NowUs() - start_us;
+    {
+        std::lock_guard<std::mutex> guard(recv.lock);
+        recv.msg_count++;
+        recv.busy_us += service_us;
+        recv.service_us.Add(service_us);
+    }
+    if (recv_batch.size() >= BATCH_SIZE) Flush();
+}
+
+void ChatPipeline::Flush() {
+    if (recv_batch.empty()) return;
+    StageStats &recv = stats[STAGE_RECV];
+    {
+        std::lock_guard<std::mutex> guard(recv.lock);
+        recv.batch_count++;
+        if (recv_batch.size() > recv.max_depth) {
+            recv.max_depth = recv_batch.size();
+        }
+    }
+    parse_queue.PushBatch(&recv_batch);
+}
+
+void ChatPipeline::Shutdown() {
+    parse_queue.Close();
+    filter_queue.Close();
+    render_queue.Close();
+    send_queue.Close();
+    dispatch_pool.Shutdown();
+    for (size_t i = 0; i < stage_threads.size(); i++) {
+        stage_threads[i].join();
+    }
+    stage_threads.clear();
+    cmds.Shutdown();
+    recv_batch.clear();
+    if (parsed_count % STATS_INTERVAL_MSGS != 0) ReportStats();
+}
+
+void ChatPipeline::RunStage(Stage stage, MsgQueue *in) {
+    std::vector<ChatMsgPtr> batch;
+    std::vector<ChatMsgPtr> out;
+    std::vector<uint64_t> service;
+    size_t depth = 0;
+    while (in->PopBatch(&batch, BATCH_SIZE, &depth)) {
+        if (stage == STAGE_FILTER) UpdateShedding(depth);
+        size_t count = batch.size();
+        for (size_t i = 0; i < count; i++) {
+            uint64_t start_us = EventLoop::NowUs();
+            bool keep = RunStep(stage, batch[i].get());
+            service.push_back(EventLoop::NowUs() - start_us);
+            if (keep) out.push_back(std::move(batch[i]));
+        }
+        RecordBatch(stage, service, depth);
+        Forward(stage, &out);
+        batch.clear();
+        service.clear();
+
+        if (stage == STAGE_PARSE) {
+            uint64_t before = parsed_count;
+            parsed_count += count;
+            // Skipped while shedding, the next one then covers both
+            if (before / STATS_INTERVAL_MSGS != 
+                parsed_count / STATS_INTERVAL_MSGS && !shedding) {
+                ReportStats();
+            }
+        }
+    }
+}
+
+bool ChatPipeline::RunStep(Stage stage, ChatMsg *msg) {
+    switch (stage) {
+    case STAGE_PARSE:
+        return ParseChatMsg(msg);
+    case STAGE_FILTER:
+        if (msg->irc.command == "PRIVMSG") {
+            // "#chan :text", chat in the other channels doesn't count
+            std::string_view params = msg->irc.parameters;
+            if (params.size() > 1 && params[0] == '#') {
+                motd->OnChatMsg(params.substr(1, params.find(' ') - 1));
+            }
+        }
+        return FilterChatMsg(msg);
+    case STAGE_RENDER:
+        RenderChatMsg(msg);
+        return true;
+    case STAGE_SEND:
+        return SendReply(msg);
+    default:
+        return false;
+    }
+}
+
+bool ChatPipeline::SendReply(ChatMsg *msg) {
+    // Whatever is left until the deadline is how long TwitchConn may hold
+    // on to the line
+    uint64_t now_us = EventLoop::NowUs();
+    if (now_us > msg->deadline_us) {
+        expired_send_count++;
+    } else {
+        uint64_t max_age_ms = (msg->deadline_us - now_us) / 1000;
+        if (max_age_ms > TwitchConn::DEFAULT_TX_MAX_AGE_MS) {
+            max_age_ms = TwitchConn::DEFAULT_TX_MAX_AGE_MS;
+        }
+        tc->SendMsg(msg->out_line, TX_LANE_CHAT, (uint32_t)max_age_ms);
+    }
+    if (msg->on_sent) msg->on_sent();
+    return false;
+}
+
+void ChatPipeline::UpdateShedding(size_t filter_depth) {
+    size_t depth = parse_queue.GetDepth() + filter_depth + dispatch_depth + 
+        render_queue.GetDepth() + send_queue.GetDepth();
+    if (!shedding && depth > SHED_DEPTH) {
+        printf("WARNING: %d msgs backed up, holding off the MOTD and "
+            "STATS\n", (int)depth);
+        shedding = true;
+        shed_count++;
+        motd->SetShedding(true);
+    } else if (shedding && depth < RESUME_DEPTH) {
+        printf("Chat backlog worked off\n");
+        shedding = false;
+        motd->SetShedding(false);
+    }
+}
+
+void ChatPipeline::Forward(Stage stage, std::vector<ChatMsgPtr> *batch) {
+    switch (stage) {
+    case STAGE_PARSE:
+        filter_queue.PushBatch(batch);
+        break;
+    case STAGE_FILTER:
+        for (size_t i = 0; i < batch->size(); i++) Dispatch((*batch)[i]);
+        batch->clear();
+        break;
+    case STAGE_RENDER:
+        send_queue.PushBatch(batch);
+        break;
+    default:
+        batch->clear();
+        break;
+    }
+}
+
+void ChatPipeline::Dispatch(const ChatMsgPtr &msg) {
+    // A channel flooding the pool loses its own msgs, the filter stage
+    // doesn't wait on it and every other channel with it. Commands that
+    // must run wait for room instead.
+    size_t depth = ++dispatch_depth;
+    WorkerPool::Job job = [this, msg, depth]() {
+        dispatch_depth--;
+        uint64_t start_us = EventLoop::NowUs();
+        if (!msg->must_run && start_us > msg->deadline_us) {
+            expired_dispatch_count++;
+            return;
+        }
+        bool keep = DispatchChatMsg(msg.get(), db, motd, &cmds);
+        std::vector<uint64_t> service(1, EventLoop::NowUs() - start_us);
+        RecordBatch(STAGE_DISPATCH, service, depth);
+        // A worker never waits on the render stage, the reply goes instead
+        ChatMsgPtr out = msg;
+        if (keep && !render_queue.TryPush(std::move(out))) {
+            dropped_reply_count++;
+        }
+    };
+    if (msg->must_run) {
+        dispatch_pool.Submit(msg->channel, std::move(job));
+    } else if (!dispatch_pool.TrySubmit(msg->channel, std::move(job))) {
+        dispatch_depth--;
+    }
+}
+
+void ChatPipeline::Say(const std::string &chan, const std::string &text, 
+    std::function<void()> &&on_sent) {
+    ChatMsgPtr msg = std::make_shared<ChatMsg>();
+    msg->channel = chan;
+    msg->reply = text;
+    msg->expand_reply = false;
+    msg->deadline_us = UINT64_MAX; // Never expires, the command waits on it
+    msg->on_sent = std::move(on_sent);
+    if (!render_queue.TryPush(std::move(msg))) {
+        // Still left as it was. The command carries on without the line.
+        dropped_reply_count++;
+        if (msg->on_sent) msg->on_sent();
+    }
+}
+
+void ChatPipeline::RecordBatch(Stage stage, 
+    const std::vector<uint64_t> &service, size_t depth) {
+    StageStats &stage_stats = stats[stage];
+    std::lock_guard<std::mutex> guard(stage_stats.lock);
+    stage_stats.msg_count += service.size();
+    stage_stats.batch_count++;
+    if (depth > stage_stats.max_depth) stage_stats.max_depth = depth;
+    for (size_t i = 0; i < service.size(); i++) {
+        stage_stats.busy_us += service[i];
+        stage_stats.service_us.Add(service[i]);
+    }
+}
+
+void ChatPipeline::ReportStats() {
+    // Busy is the share of wall time the stage spent working, the stage
+    // closest to 100% is the one holding everything up. For dispatch it is
+    // summed over the workers, so it can go up to 100% per worker.
+    uint64_t now_ms = EventLoop::NowMs();
+    double secs = (now_ms - stats_start_ms) / 1000.0;
+    for (int i = 0; i < NUM_STAGES; i++) {
+        StageStats &stage = stats[i];
+        std::lock_guard<std::mutex> guard(stage.lock);
+        uint64_t batches = stage.batch_count > 0 ? stage.batch_count : 1;
+        printf("STATS: %s stage, %llu msgs in %llu batches (avg %.1f), "
+            "max queue depth %llu, service p50 %llu us, p99 %llu us, "
+            "max %llu us, %.1f%% busy\n", STAGE_NAMES[i], 
+            (unsigned long long)stage.msg_count, 
+            (unsigned long long)stage.batch_count, 
+            (double)stage.msg_count / batches,
+            (unsigned long long)stage.max_depth,
+            (unsigned long long)stage.service_us.GetPercentile(50),
+            (unsigned long long)stage.service_us.GetPercentile(99),
+            (unsigned long long)stage.service_us.GetMax(),
+            secs > 0 ? stage.busy_us / (secs * 10000.0) : 0.0);
+        stage.msg_count = 0;
+        stage.batch_count = 0;
+        stage.busy_us = 0;
+        stage.max_depth = 0;
+        stage.service_us.Reset();
+    }
+    printf("STATS: %llu cmds expired before dispatch, %llu replies expired "
+        "before send, %llu replies dropped with render full, optional work "
+        "shed %llu times\n", 
+        (unsigned long long)expired_dispatch_count.load(), 
+        (unsigned long long)expired_send_count.load(), 
+        (unsigned long long)dropped_reply_count.load(), 
+        (unsigned long long)shed_count.load());
+    stats_start_ms = now_ms;
+}
+
+// Static initializers
+const size_t ChatPipeline::QUEUE_SIZE;
+const size_t ChatPipeline::BATCH_SIZE;
+const uint64_t ChatPipeline::STATS_INTERVAL_MSGS;
+const size_t ChatPipeline::SHED_DEPTH;
+const size_t ChatPipeline::RESUME_DEPTH;
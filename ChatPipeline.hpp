@@ -0,0 +1,145 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_CHAT_PIPELINE_HPP
+#define CHIPSIE_CHAT_PIPELINE_HPP
+
+#include "BoundedQueue.hpp"
+#include "ChatProcessing.hpp"
+#include "CmdRuntime.hpp"
+#include "Database.hpp"
+#include "EventLoop.hpp"
+#include "Histogram.hpp"
+#include "MotdEngine.hpp"
+#include "TwitchConn.hpp"
+#include "WorkerPool.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Chat processing split into stages joined by bounded queues:
+//   recv -> parse -> filter -> dispatch -> render -> send
+// Every stage works through its queue in batches on a thread of its own,
+// except dispatch. Dispatch does the database work, so it runs on the
+// worker pool with one strand per channel. Since all the other stages are
+// FIFO, each channel's replies still go out in order. Coroutine commands
+// are the exception, they reply whenever they get there. A STATS line per
+// stage shows where the time goes.
+//
+// Commands that sat around past their deadline are dropped before
+// dispatch, and replies past it before they are sent. Once too much piles
+// up in the queues, the MOTD and the STATS lines hold off until the
+// backlog is worked off again.
+class ChatPipeline {
+public:
+    ChatPipeline();
+    // loop runs the coroutine commands' timers, it must be the one of the
+    // thread that calls Shutdown()
+    bool Start(TwitchConn *twitch_conn, Database *database, 
+        MotdEngine *motd_engine, EventLoop *loop, int num_workers);
+    // The recv stage, meant for the thread that takes the rx msgs. Lines
+    // are collected into a batch that goes to the parse stage once it is
+    // full or on Flush().
+    void Submit(std::string_view line, uint64_t arrival_us);
+    void Flush();
+    // Msgs still on their way through are dropped
+    void Shutdown();
+    int GetNumWorkers() const { return dispatch_pool.GetNumWorkers(); }
+    // Weight of the channel's commands when several channels are busy
+    void SetChannelShare(const std::string &channel, uint32_t share) {
+        dispatch_pool.SetShare(channel, share);
+    }
+
+private:
+    static const size_t QUEUE_SIZE = 4096;
+    static const size_t BATCH_SIZE = 64;
+    static const uint64_t STATS_INTERVAL_MSGS = 10000;
+    // Msgs queued between the stages before optional work is shed, and
+    // how far that has to drop again before it resumes
+    static const size_t SHED_DEPTH = 2048;
+    static const size_t RESUME_DEPTH = 512;
+
+    enum Stage {
+        STAGE_RECV,
+        STAGE_PARSE,
+        STAGE_FILTER,
+        STAGE_DISPATCH,
+        STAGE_RENDER,
+        STAGE_SEND,
+        NUM_STAGES
+    };
+
+    struct StageStats {
+        std::mutex lock;
+        uint64_t msg_count;
+        uint64_t batch_count;
+        uint64_t busy_us;
+        size_t max_depth; // Of the stage's input queue
+        Histogram service_us; // Per msg
+    };
+
+    typedef std::shared_ptr<ChatMsg> ChatMsgPtr;
+    typedef BoundedQueue<ChatMsgPtr> MsgQueue;
+
+    TwitchConn *tc;
+    Database *db;
+    MotdEngine *motd;
+    std::vector<ChatMsgPtr> recv_batch;
+    MsgQueue parse_queue;
+    MsgQueue filter_queue;
+    WorkerPool dispatch_pool;
+    std::atomic<size_t> dispatch_depth;
+    CmdRuntime cmds;
+    MsgQueue render_queue;
+    MsgQueue send_queue;
+    std::vector<std::thread> stage_threads;
+
+    std::atomic<bool> shedding; // Changed by the filter stage only
+    std::atomic<uint64_t> shed_count;
+    std::atomic<uint64_t> expired_dispatch_count;
+    std::atomic<uint64_t> expired_send_count;
+    std::atomic<uint64_t> dropped_reply_count; // Render queue was full
+
+    StageStats stats[NUM_STAGES];
+    uint64_t parsed_count; // Parse stage only, paces the STATS lines
+    uint64_t stats_start_ms;
+
+    void RunStage(Stage stage, MsgQueue *in);
+    bool RunStep(Stage stage, ChatMsg *msg);
+    bool SendReply(ChatMsg *msg);
+    void UpdateShedding(size_t filter_depth);
+    void Forward(Stage stage, std::vector<ChatMsgPtr> *batch);
+    void Dispatch(const ChatMsgPtr &msg);
+    void Say(const std::string &chan, const std::string &text, 
+        std::function<void()> &&on_sent);
+    void RecordBatch(Stage stage, const std::vector<uint64_t> &service, 
+        size_t depth);
+    void ReportStats();
+};
+
+#endif // CHIPSIE_CHAT_PIPELINE_HPP
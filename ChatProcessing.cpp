@@ -25,42 +25,73 @@
 #include "ChatProcessing.hpp"
 #include <queue>
 #include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 
-struct IrcMessage
-{
-    std::string tags;
-    std::string source;
-    std::string command;
-    std::string parameters;    
-};
-
-size_t AdvToNonWhitespace(const std::string &line, size_t cursor);
-void HandlePrivMessage(const IrcMessage &irc_msg, TwitchConn *tc,
-    Database *db);
-void HandleUserCmd(const IrcMessage &irc_msg, TwitchConn *tc, Database *db,
+size_t AdvToNonWhitespace(std::string_view line, size_t cursor);
+bool HandlePrivMessage(ChatMsg *msg);
+bool HandleUserCmd(ChatMsg *msg, Database *db, MotdEngine *motd, 
     const std::string &chan, const std::string &cmd, 
     const std::string &sender, const std::string &params);
 bool IsPrivileged(const std::string &user, const std::string &chan, 
     Database *db);
 void ProcessOutputString(std::string &input, const std::string &chan, 
-    const std::string &cmd, const std::string &sender, 
-    std::queue<std::string> &params);
+    const std::string &sender, std::queue<std::string> &params);
+CmdTask CountdownCmd(CmdContext ctx);
+
+// Commands that take a while, e.g. because they pace their replies. They
+// run as coroutines so their channel can carry on in the meantime.
+struct CoroutineCmd {
+    const char *name;
+    CmdRuntime::Handler handler;
+};
+
+static const CoroutineCmd COROUTINE_CMDS[] = {
+    { "countdown", CountdownCmd }
+};
 
-void ProcessChatLine(const std::string &line, TwitchConn *tc, Database *db) {
+static const int MAX_COUNTDOWN = 10;
 
-    // First break the line down to its IRC message components
-    IrcMessage irc_msg;
+// How long after the line came in a reply is still of use. Commands that
+// change something always run, it is only their reply that can be late.
+struct CmdDeadline {
+    const char *name;
+    uint32_t deadline_ms;
+    bool must_run;
+};
+
+static const CmdDeadline CMD_DEADLINES[] = {
+    { "addadmin", 30000, true },
+    { "rmadmin", 30000, true },
+    { "addcmd", 30000, true },
+    { "rmcmd", 30000, true },
+    { "addmotd", 30000, true },
+    { "rmmotd", 30000, true },
+    { "motdrate", 30000, true },
+    { "motdon", 30000, true },
+    { "motdoff", 30000, true },
+    { "countdown", 5000, false }
+};
+
+// Custom commands, chat has moved on if they take longer than this
+static const uint32_t DEFAULT_CMD_DEADLINE_MS = 10000;
+
+bool ParseChatMsg(ChatMsg *msg) {
+    // Break the line down to its IRC message components
+    std::string_view line = msg->line;
+    IrcMessage &irc_msg = msg->irc;
     size_t cursor = 0;
     cursor = AdvToNonWhitespace(line, cursor);
-    if (cursor >= line.size()) return;
+    if (cursor >= line.size()) return false;
 
     if (line[cursor] == '@') { // Line contains tags
         size_t tag_end = line.find(' ', cursor);
         cursor++;
-        irc_msg.tags = line.substr(cursor, tag_end - cursor);
+        irc_msg.tags = std::string(line.substr(cursor, tag_end - cursor));
         cursor = tag_end;
         cursor = AdvToNonWhitespace(line, cursor);
-        if (cursor >= line.size()) return;
+        if (cursor >= line.size()) return false;
     } else {
         irc_msg.tags = "";
     }
@@ -68,40 +99,43 @@ void ProcessChatLine(const std::string &line, TwitchConn *tc, Database *db) {
     if (line[cursor] == ':') { // Line contains a source
         size_t src_end = line.find(' ', cursor);
         cursor++;
-        irc_msg.source = line.substr(cursor, src_end - cursor);
+        irc_msg.source = std::string(line.substr(cursor, src_end - cursor));
         cursor = src_end;
         cursor = AdvToNonWhitespace(line, cursor);
-        if (cursor >= line.size()) return;
+        if (cursor >= line.size()) return false;
     } else {
        irc_msg.source = "";
     }
 
     // A command must be present
     size_t cmd_end = line.find(' ', cursor);
-    irc_msg.command = line.substr(cursor, cmd_end - cursor);
+    irc_msg.command = std::string(line.substr(cursor, cmd_end - cursor));
     cursor = cmd_end;
     cursor = AdvToNonWhitespace(line, cursor);
-    if (cursor >= line.size()) return;
+    if (cursor >= line.size()) return false;
 
     // Params are whatever is left over
-    irc_msg.parameters = line.substr(cursor, line.size() - cursor);
-
+    irc_msg.parameters = std::string(line.substr(cursor));
+    return true;
+}
 
-    // Next, handle the command
+bool FilterChatMsg(ChatMsg *msg) {
+    // Only user commands go on to be dispatched, everything else ends here
+    const IrcMessage &irc_msg = msg->irc;
     if (irc_msg.command == "PRIVMSG") { // Private message
-        HandlePrivMessage(irc_msg, tc, db);
+        return HandlePrivMessage(msg);
     
     } else if (irc_msg.command == "WHISPER") { // Direct whisper
 
     } else if (irc_msg.command == "PING") { // Ping message
-        // Always reply with a pong so we don't get booted
-        std::string reply = "PONG " + irc_msg.parameters;
-        tc->SendMsg(reply);
+        // Answered by the network thread, so we don't get booted while
+        // processing is busy
     } else if (irc_msg.command == "JOIN") {// Join command reply
     
-    } else if (irc_msg.command == "USERSTATE") {
-
-    } else if (irc_msg.command == "ROOMSTATE") {
+    } else if (irc_msg.command == "USERSTATE" || 
+        irc_msg.command == "ROOMSTATE" || irc_msg.command == "NOTICE") {
+        // Read by the network thread, which paces what we send by them
+    } else if (irc_msg.command == "GLOBALUSERSTATE") {
 
     } else if (irc_msg.command == "CAP") {
 
@@ -126,23 +160,55 @@ void ProcessChatLine(const std::string &line, TwitchConn *tc, Database *db) {
     } else {
         printf("ALERT: Unknown command %s\n", irc_msg.command.c_str());
     }
+    return false;
 }
 
-size_t AdvToNonWhitespace(const std::string &line, size_t cursor) {
-    while (isspace(line[cursor]) && cursor < line.size()) {
+bool DispatchChatMsg(ChatMsg *msg, Database *db, MotdEngine *motd, 
+    CmdRuntime *cmds) {
+    msg->expand_reply = false;
+    for (const CoroutineCmd &coroutine_cmd : COROUTINE_CMDS) {
+        if (msg->cmd != coroutine_cmd.name) continue;
+        printf("Got cmd %s from %s\n", msg->cmd.c_str(), 
+            msg->sender.c_str());
+        cmds->Spawn(coroutine_cmd.handler, msg->channel, msg->sender, 
+            msg->params);
+        return false;
+    }
+    return HandleUserCmd(msg, db, motd, msg->channel, msg->cmd, msg->sender, 
+        msg->params);
+}
+
+void RenderChatMsg(ChatMsg *msg) {
+    using namespace std;
+
+    if (msg->expand_reply) {
+        queue<string> param_list;
+        stringstream sstream(msg->params);
+        string temp_str;
+        while (getline(sstream, temp_str, ' ')) {
+            param_list.push(temp_str);
+        }
+        ProcessOutputString(msg->reply, msg->channel, msg->sender, 
+            param_list);
+    }
+    msg->out_line = "PRIVMSG #" + msg->channel + " :" + msg->reply;
+}
+
+size_t AdvToNonWhitespace(std::string_view line, size_t cursor) {
+    while (cursor < line.size() && isspace(line[cursor])) {
         cursor++;
     }
     return cursor;
 }
 
-void HandlePrivMessage(const IrcMessage &irc_msg, TwitchConn *tc, 
-    Database *db) {
+bool HandlePrivMessage(ChatMsg *msg) {
     using namespace std;
 
+    const IrcMessage &irc_msg = msg->irc;
     size_t cursor = AdvToNonWhitespace(irc_msg.parameters, 0);
     if (irc_msg.parameters[cursor] != '#') {
         printf("WARNING: Received malformed PRIVMSG command\n");
-        return;
+        return false;
     }
 
     size_t end = irc_msg.parameters.find(' ', cursor);
@@ -153,7 +219,7 @@ void HandlePrivMessage(const IrcMessage &irc_msg, TwitchConn *tc,
     cursor = irc_msg.parameters.find(':', cursor);
     if (cursor == string::npos) {
         printf("WARNING: Received PRIVMSG with no text\n");
-        return;
+        return false;
     }
     cursor++;
     string priv_msg = irc_msg.parameters.substr(cursor);
@@ -180,13 +246,27 @@ void HandlePrivMessage(const IrcMessage &irc_msg, TwitchConn *tc,
         if (end < priv_msg.length()) {
             params = priv_msg.substr(end + 1);
         }
-        HandleUserCmd(irc_msg, tc, db, channel, user_cmd, sender, params);
+        msg->channel = channel;
+        msg->cmd = user_cmd;
+        msg->sender = sender;
+        msg->params = params;
+        uint32_t deadline_ms = DEFAULT_CMD_DEADLINE_MS;
+        msg->must_run = false;
+        for (const CmdDeadline &cmd_deadline : CMD_DEADLINES) {
+            if (user_cmd != cmd_deadline.name) continue;
+            deadline_ms = cmd_deadline.deadline_ms;
+            msg->must_run = cmd_deadline.must_run;
+            break;
+        }
+        msg->deadline_us = msg->arrival_us + deadline_ms * 1000ULL;
+        return true;
     } else {
         // TODO: mod stuff
     }
+    return false;
 }
 
-void HandleUserCmd(const IrcMessage &irc_msg, TwitchConn *tc, Database *db,
+bool HandleUserCmd(ChatMsg *msg, Database *db, MotdEngine *motd, 
     const std::string &chan, const std::string &cmd, 
     const std::string &sender, const std::string &params) {
     
@@ -197,123 +277,177 @@ void HandleUserCmd(const IrcMessage &irc_msg, TwitchConn *tc, Database *db,
         if (sender != chan) {
             printf("ALERT: Unauthorized attempted use of addop cmd by %s\n",
                 sender.c_str());
-            string resp = "PRIVMSG #" + chan + "Hey @" + sender + 
+            msg->reply = "Hey @" + sender + 
                 ", you aren't allowed to use that command! >(";
-            tc->SendMsg(resp);
-            return;
+            return true;
         }
 
-        int cursor = 0;
+        size_t cursor = 0;
         while (cursor < params.length() && params[cursor] == ' ') cursor++;
-        if (cursor == params.length()) cursor = (int)params.length() - 1; 
+        if (cursor == params.length()) return false; // No name given
         size_t end = params.find(' ', cursor);
         if (end == string::npos) end = params.length();
         string admin_name = params.substr(cursor, end - cursor);
-        if (admin_name.empty()) return;
+        if (admin_name.empty()) return false;
 
         if (!db->IsAdmin(admin_name)) {
             db->AddAdmin(admin_name);
             printf("Added %s to admins\n", admin_name.c_str());
-            string resp = "PRIVMSG #" + chan + " :" +  admin_name + 
+            msg->reply = admin_name + 
                 " is now a Chipsie admin. Be nice to me! ;)";
-            tc->SendMsg(resp);
+            return true;
         }
     } else if (cmd == "rmadmin") {
         if (sender != chan) {
             printf("ALERT: Unauthorized attempted use of addop cmd by %s\n",
                 sender.c_str());
-            string resp = "PRIVMSG #" + chan + "Hey @" + sender + 
+            msg->reply = "Hey @" + sender + 
                 ", you aren't allowed to use that command! >(";
-            tc->SendMsg(resp);
-            return;
+            return true;
         }
 
-        int cursor = 0;
+        size_t cursor = 0;
         while (cursor < params.length() && params[cursor] == ' ') cursor++;
-        if (cursor == params.length()) cursor = (int)params.length() - 1; 
+        if (cursor == params.length()) return false; // No name given
         size_t end = params.find(' ', cursor);
         if (end == string::npos) end = params.length();
         string admin_name = params.substr(cursor, end - cursor);
-        if (admin_name.empty()) return;
+        if (admin_name.empty()) return false;
         if (db->IsAdmin(admin_name)) {
             db->RemAdmin(admin_name);
             printf("Removed admin %s\n", admin_name.c_str());
-            string resp = "PRIVMSG #" + chan + " :OK " + sender + 
-                ", I removed " + admin_name + " as a Chipsie admin! :D";
-            tc->SendMsg(resp);
+            msg->reply = "OK " + sender + ", I removed " + admin_name + 
+                " as a Chipsie admin! :D";
+            return true;
         } 
     } else if (cmd == "addcmd") {
         if (!IsPrivileged(sender, chan, db)) {
             printf("ALERT: Unauthorized attempted use of addcmd by %s\n",
                 sender.c_str());
-            string resp = "PRIVMSG #" + chan + " :Hey @" + sender + 
+            msg->reply = "Hey @" + sender + 
                 ", you aren't allowed to use that command! >(";
-            tc->SendMsg(resp);
-            return;
+            return true;
         }
 
         size_t cursor = 0;
         while (cursor < params.length() && params[cursor] == ' ') cursor++;
-        if (cursor == params.length()) return;
+        if (cursor == params.length()) return false;
         size_t end = params.find(' ', cursor);
-        if (end == string::npos) return;
+        if (end == string::npos) return false;
         string cmd_name = params.substr(cursor, end - cursor);
 
-        cursor = (int)end + 1;
+        cursor = end + 1;
         while (cursor < params.length() && params[cursor] == ' ') cursor++;
-        if (cursor == params.length()) return;
+        if (cursor == params.length()) return false;
         string cmd_resp = params.substr(cursor);
 
         if (db->CmdExists(cmd_name)) db->RemCmd(cmd_name);
         db->AddCmd(cmd_name, cmd_resp);
         printf("Set command %s to %s\n", cmd_name.c_str(), cmd_resp.c_str());
-        string resp = "PRIVMSG #" + chan + " :OK " + sender + ", I added the " +
-            cmd_name + " command! :D";
-        tc->SendMsg(resp);
+        msg->reply = "OK " + sender + ", I added the " + cmd_name + 
+            " command! :D";
+        return true;
     } else if (cmd == "rmcmd") {
         if (!IsPrivileged(sender, chan, db)) {
             printf("ALERT: Unauthorized attempted use of addcmd by %s\n",
                 sender.c_str());
-            string resp = "PRIVMSG #" + chan + " :Hey @" + sender + 
+            msg->reply = "Hey @" + sender + 
                 ", you aren't allowed to use that command! >(";
-            tc->SendMsg(resp);
-            return;
+            return true;
         }
 
         size_t cursor = 0;
         while (cursor < params.length() && params[cursor] == ' ') cursor++;
-        if (cursor == params.length()) return;
+        if (cursor == params.length()) return false;
         size_t end = params.find(' ', cursor);
-        if (end == string::npos) return;
+        if (end == string::npos) return false;
         string cmd_name = params.substr(cursor, end - cursor);
 
         if (db->CmdExists(cmd_name)) {
             db->RemCmd(cmd_name);
             printf("Removed command %s\n", cmd_name.c_str());
-            string resp = "PRIVMSG #" + chan + " :OK " + sender + 
-                ", I removed the " + cmd_name + " command! :D";
-            tc->SendMsg(resp);
+            msg->reply = "OK " + sender + ", I removed the " + cmd_name + 
+                " command! :D";
+            return true;
         }
 
+    } else if (cmd == "addmotd" || cmd == "rmmotd" || cmd == "motdrate" ||
+        cmd == "motdon" || cmd == "motdoff") {
+        if (!IsPrivileged(sender, chan, db)) {
+            printf("ALERT: Unauthorized attempted use of %s by %s\n",
+                cmd.c_str(), sender.c_str());
+            msg->reply = "Hey @" + sender + 
+                ", you aren't allowed to use that command! >(";
+            return true;
+        }
+
+        size_t cursor = 0;
+        while (cursor < params.length() && params[cursor] == ' ') cursor++;
+        string arg = params.substr(cursor);
+        if (cmd == "addmotd") {
+            if (arg.empty()) return false;
+            int64_t number = motd->AddMotd(arg);
+            if (number == 0) return false;
+            printf("Added MOTD #%lld: %s\n", (long long)number, arg.c_str());
+            msg->reply = "OK " + sender + ", I added MOTD #" + 
+                to_string(number) + "! :D";
+        } else if (cmd == "rmmotd") {
+            int64_t number = atoll(arg.c_str());
+            if (!motd->RemMotd(number)) return false;
+            printf("Removed MOTD #%lld\n", (long long)number);
+            msg->reply = "OK " + sender + ", I removed MOTD #" + 
+                to_string(number) + "! :D";
+        } else if (cmd == "motdrate") {
+            int minutes = atoi(arg.c_str());
+            if (minutes < 1) return false;
+            motd->SetRate((uint32_t)minutes);
+            printf("Set MOTD rate to %d minutes\n", minutes);
+            msg->reply = "OK " + sender + ", MOTDs now go out every " + 
+                to_string(minutes) + " minutes! :D";
+        } else {
+            bool enabled = cmd == "motdon";
+            motd->SetEnabled(enabled);
+            printf("MOTDs %s\n", enabled ? "enabled" : "disabled");
+            msg->reply = "OK " + sender + ", MOTDs are now " + 
+                (enabled ? "on" : "off") + "! :D";
+        }
+        return true;
     } else { // Custom command?
         if (!db->CmdExists(cmd)) {
-            return;
+            return false;
         }
 
-        queue<string> param_list;
-        stringstream sstream(params);
-        string temp_str;
-        while (getline(sstream, temp_str, ' ')) {
-            param_list.push(temp_str);
-        }
-        string resp;
-        db->GetCmdResp(cmd, &resp);
-        ProcessOutputString(resp, chan, cmd, sender, param_list);
-        string fmt_resp = "PRIVMSG #" + chan + " :" + resp;
-        tc->SendMsg(fmt_resp);
+        // The wildcards are filled in when the reply is rendered
+        db->GetCmdResp(cmd, &msg->reply);
+        msg->expand_reply = true;
+        return true;
     }
+    return false;
  }
 
+CmdTask CountdownCmd(CmdContext ctx) {
+    bool privileged = false;
+    co_await ctx.Db([&](Database *db) {
+        privileged = IsPrivileged(ctx.sender, ctx.channel, db);
+    });
+    if (!privileged) {
+        printf("ALERT: Unauthorized attempted use of countdown by %s\n",
+            ctx.sender.c_str());
+        co_await ctx.Say("Hey @" + ctx.sender + 
+            ", you aren't allowed to use that command! >(");
+        co_return;
+    }
+
+    int count = atoi(ctx.params.c_str());
+    if (count < 1) count = 3;
+    if (count > MAX_COUNTDOWN) count = MAX_COUNTDOWN;
+    for (int i = count; i > 0; i--) {
+        co_await ctx.Say(std::to_string(i) + "...");
+        co_await ctx.Sleep(1000);
+    }
+    co_await ctx.Say("Go! :D");
+}
+
 bool IsPrivileged(const std::string &user, const std::string &chan, 
     Database *db) {
     if (user == chan) return true;
@@ -322,8 +456,7 @@ bool IsPrivileged(const std::string &user, const std::string &chan,
 }
 
 void ProcessOutputString(std::string &input, const std::string &chan, 
-    const std::string &cmd,  const std::string &sender, 
-    std::queue<std::string> &params)
+    const std::string &sender, std::queue<std::string> &params)
 {
     using namespace std;
 
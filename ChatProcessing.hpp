@@ -25,10 +25,46 @@
 #ifndef CHIPSIE_CHAT_PROCESSING_HPP
 #define CHIPSIE_CHAT_PROCESSING_HPP
 
+#include <stdint.h>
+#include <functional>
 #include <string>
-#include "TwitchConn.hpp"
+#include <string_view>
+#include "CmdRuntime.hpp"
 #include "Database.hpp"
+#include "MotdEngine.hpp"
 
-void ProcessChatLine(const std::string &line, TwitchConn *tc, Database *db);
+struct IrcMessage
+{
+    std::string tags;
+    std::string source;
+    std::string command;
+    std::string parameters;    
+};
+
+// A chat line on its way through the ChatPipeline stages. Each stage fills
+// in what the next one needs.
+struct ChatMsg {
+    std::string line;
+    uint64_t arrival_us; // When the network thread read it
+    IrcMessage irc; // Parse
+    std::string channel; // Filter, only user commands get this far
+    std::string sender;
+    std::string cmd;
+    std::string params;
+    uint64_t deadline_us; // Reply isn't worth sending after this
+    bool must_run; // Changes something, so it runs even past the deadline
+    std::string reply; // Dispatch, what to say in the channel
+    bool expand_reply; // Dispatch, reply still has [wildcards] in it
+    std::string out_line; // Render
+    std::function<void()> on_sent; // Send, once handed to TwitchConn
+};
+
+// The bool ones return false if the msg ends there
+bool ParseChatMsg(ChatMsg *msg);
+bool FilterChatMsg(ChatMsg *msg);
+// Coroutine commands are handed to cmds and never reply here
+bool DispatchChatMsg(ChatMsg *msg, Database *db, MotdEngine *motd, 
+    CmdRuntime *cmds);
+void RenderChatMsg(ChatMsg *msg);
 
 #endif // SAT_CHAT_PROCESSOR_HPP
\ No newline at end of file
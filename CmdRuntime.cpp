@@ -0,0 +1,189 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "CmdRuntime.hpp"
+#include <stdio.h>
+
+void CmdTask::promise_type::unhandled_exception() {
+    printf("ERROR: Command handler stopped with an exception\n");
+}
+
+void CmdTask::FinalAwaiter::await_suspend(Handle handle) noexcept {
+    handle.promise().runtime->OnFinished(handle);
+}
+
+void CmdContext::SleepAwaiter::await_suspend(
+    std::coroutine_handle<> handle) {
+    runtime->SleepThen(*channel, delay_ms, handle);
+}
+
+void CmdContext::DbAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    runtime->DbThen(*channel, std::move(op), handle);
+}
+
+void CmdContext::SayAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    runtime->SayThen(*channel, text, handle);
+}
+
+CmdRuntime::CmdRuntime() {
+    loop = NULL;
+    pool = NULL;
+    db = NULL;
+    stopping = false;
+}
+
+bool CmdRuntime::Init(EventLoop *event_loop, WorkerPool *worker_pool, 
+    Database *database, const SayFunc &say_func) {
+    loop = event_loop;
+    pool = worker_pool;
+    db = database;
+    say = say_func;
+    if (!wakeup.Init()) return false;
+    loop->Watch(wakeup.GetHandle(), EV_READ, [this](uint32_t) {
+        wakeup.Clear();
+        RunPosted();
+    });
+    return true;
+}
+
+bool CmdRuntime::Spawn(Handler handler, const std::string &chan, 
+    const std::string &sender, const std::string &params) {
+    CmdTask task = handler(CmdContext{this, chan, sender, params});
+    CmdTask::Handle handle = task.GetHandle();
+    handle.promise().runtime = this;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (active.size() >= MAX_ACTIVE_CMDS) {
+            printf("WARNING: %d commands already running, dropped one "
+                "from %s\n", (int)active.size(), sender.c_str());
+            handle.destroy();
+            return false;
+        }
+        active.insert(handle.address());
+    }
+    handle.resume();
+    return true;
+}
+
+void CmdRuntime::Shutdown() {
+    stopping = true;
+    loop->Unwatch(wakeup.GetHandle());
+    wakeup.Shutdown();
+
+    std::lock_guard<std::mutex> guard(lock);
+    posted.clear();
+    if (!active.empty()) {
+        printf("Dropped %d suspended commands\n", (int)active.size());
+    }
+    for (void *frame : active) {
+        std::coroutine_handle<>::from_address(frame).destroy();
+    }
+    active.clear();
+}
+
+size_t CmdRuntime::GetNumActive() {
+    std::lock_guard<std::mutex> guard(lock);
+    return active.size();
+}
+
+void CmdRuntime::SleepThen(const std::string &chan, uint32_t delay_ms, 
+    std::coroutine_handle<> handle) {
+    // The loop's timers are only safe to touch from its own thread
+    std::string chan_copy = chan;
+    Post([this, chan_copy, delay_ms, handle]() {
+        loop->AddTimer(delay_ms, [this, chan_copy, handle]() {
+            Resume(chan_copy, handle);
+        });
+    });
+}
+
+void CmdRuntime::DbThen(const std::string &chan, CmdContext::DbOp &&op, 
+    std::coroutine_handle<> handle) {
+    std::string chan_copy = chan;
+    CmdContext::DbOp db_op = std::move(op);
+    Post([this, chan_copy, db_op, handle]() {
+        Submit(DB_STRAND_PREFIX + chan_copy, 
+            [this, chan_copy, db_op, handle]() {
+                db_op(db);
+                Post([this, chan_copy, handle]() {
+                    Resume(chan_copy, handle);
+                });
+            });
+    });
+}
+
+void CmdRuntime::SayThen(const std::string &chan, const std::string &text, 
+    std::coroutine_handle<> handle) {
+    std::string chan_copy = chan;
+    say(chan, text, [this, chan_copy, handle]() {
+        Post([this, chan_copy, handle]() {
+            Resume(chan_copy, handle);
+        });
+    });
+}
+
+void CmdRuntime::OnFinished(CmdTask::Handle handle) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        active.erase(handle.address());
+    }
+    handle.destroy();
+}
+
+void CmdRuntime::Post(std::function<void()> &&job) {
+    if (stopping) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        posted.push_back(std::move(job));
+    }
+    wakeup.Signal();
+}
+
+void CmdRuntime::RunPosted() {
+    std::vector<std::function<void()> > jobs;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.swap(posted);
+    }
+    for (size_t i = 0; i < jobs.size(); i++) jobs[i]();
+}
+
+void CmdRuntime::Resume(const std::string &chan, 
+    std::coroutine_handle<> handle) {
+    Submit(chan, [handle]() { handle.resume(); });
+}
+
+void CmdRuntime::Submit(const std::string &key, const WorkerPool::Job &job) {
+    // On the loop's thread, which mustn't wait for room in the pool
+    if (stopping) return;
+    if (pool->TrySubmit(key, WorkerPool::Job(job))) return;
+    loop->AddTimer(RESUBMIT_DELAY_MS, [this, key, job]() {
+        Submit(key, job);
+    });
+}
+
+// Static initializers
+const size_t CmdRuntime::MAX_ACTIVE_CMDS;
+const char * const CmdRuntime::DB_STRAND_PREFIX = "db ";
+const uint32_t CmdRuntime::RESUBMIT_DELAY_MS;
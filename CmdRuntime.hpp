@@ -0,0 +1,199 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_CMD_RUNTIME_HPP
+#define CHIPSIE_CMD_RUNTIME_HPP
+
+#include "Database.hpp"
+#include "EventLoop.hpp"
+#include "Wakeup.hpp"
+#include "WorkerPool.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class CmdRuntime;
+
+// Return type of a coroutine command handler. CmdRuntime::Spawn() starts
+// the handler and the handler frees itself once it is done, so there is
+// nothing to hold on to.
+class CmdTask {
+public:
+    struct FinalAwaiter;
+
+    struct promise_type {
+        CmdRuntime *runtime;
+
+        promise_type() : runtime(NULL) {}
+        CmdTask get_return_object() {
+            return CmdTask(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept;
+        void return_void() {}
+        void unhandled_exception();
+    };
+
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        void await_suspend(Handle handle) noexcept;
+        void await_resume() noexcept {}
+    };
+
+    explicit CmdTask(Handle h) : handle(h) {}
+    Handle GetHandle() const { return handle; }
+
+private:
+    Handle handle;
+};
+
+inline CmdTask::FinalAwaiter CmdTask::promise_type::final_suspend() noexcept {
+    return {};
+}
+
+// What a coroutine command gets to work with. Awaiting Sleep(), Db() or
+// Say() suspends the command without holding up the rest of its channel.
+// It carries on on the channel's strand afterwards, so a command never
+// runs at the same time as anything else from its channel.
+struct CmdContext {
+    typedef std::function<void(Database *db)> DbOp;
+
+    struct SleepAwaiter {
+        CmdRuntime *runtime;
+        const std::string *channel;
+        uint32_t delay_ms;
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() const {}
+    };
+
+    struct DbAwaiter {
+        CmdRuntime *runtime;
+        const std::string *channel;
+        DbOp op;
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() const {}
+    };
+
+    // Resumes once the line has been handed to the Twitch connection
+    struct SayAwaiter {
+        CmdRuntime *runtime;
+        const std::string *channel;
+        std::string text;
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() const {}
+    };
+
+    CmdRuntime *runtime;
+    std::string channel;
+    std::string sender;
+    std::string params;
+
+    SleepAwaiter Sleep(uint32_t delay_ms) const {
+        return SleepAwaiter{runtime, &channel, delay_ms};
+    }
+    DbAwaiter Db(DbOp &&op) const {
+        return DbAwaiter{runtime, &channel, std::move(op)};
+    }
+    SayAwaiter Say(const std::string &text) const {
+        return SayAwaiter{runtime, &channel, text};
+    }
+};
+
+// Runs the coroutine command handlers. Commands start on the dispatch
+// worker of their channel. When one is suspended, whatever it waits on
+// gets back to the loop's thread through a Wakeup, and from there the
+// command is queued on its channel's strand again. Only the loop's thread
+// submits to the pool, and it never blocks there: when the pool or the
+// strand is full it tries again a little later.
+class CmdRuntime {
+public:
+    typedef CmdTask (*Handler)(CmdContext ctx);
+    // Puts a line on its way to the channel and calls on_sent once it has
+    // been handed to the Twitch connection
+    typedef std::function<void(const std::string &chan, 
+        const std::string &text, std::function<void()> &&on_sent)> SayFunc;
+
+    static const size_t MAX_ACTIVE_CMDS = 64;
+
+    CmdRuntime();
+    // Timers run on loop, DB ops and the commands themselves on pool
+    bool Init(EventLoop *event_loop, WorkerPool *worker_pool, 
+        Database *database, const SayFunc &say_func);
+    // Meant for the dispatch worker of chan. Runs the handler up to its
+    // first co_await. False if too many commands are already running.
+    bool Spawn(Handler handler, const std::string &chan, 
+        const std::string &sender, const std::string &params);
+    // Call once the pool has stopped, commands still suspended are dropped
+    void Shutdown();
+    size_t GetNumActive();
+
+    // Used by the awaiters in CmdContext
+    void SleepThen(const std::string &chan, uint32_t delay_ms, 
+        std::coroutine_handle<> handle);
+    void DbThen(const std::string &chan, CmdContext::DbOp &&op, 
+        std::coroutine_handle<> handle);
+    void SayThen(const std::string &chan, const std::string &text, 
+        std::coroutine_handle<> handle);
+    void OnFinished(CmdTask::Handle handle);
+
+private:
+    // Each channel's DB ops get a strand of their own, so a slow query only
+    // holds up its own channel. The connection is opened with
+    // SQLITE_OPEN_FULLMUTEX, so the strands can share it. Channel names
+    // can't have spaces.
+    static const char * const DB_STRAND_PREFIX;
+    static const uint32_t RESUBMIT_DELAY_MS = 10;
+
+    EventLoop *loop;
+    WorkerPool *pool;
+    Database *db;
+    SayFunc say;
+    Wakeup wakeup;
+    std::atomic<bool> stopping;
+
+    std::mutex lock; // Guards everything below
+    std::vector<std::function<void()> > posted; // Run on the loop's thread
+    std::unordered_set<void *> active; // Frame addresses
+
+    void Post(std::function<void()> &&job);
+    void RunPosted();
+    void Resume(const std::string &chan, std::coroutine_handle<> handle);
+    void Submit(const std::string &key, const WorkerPool::Job &job);
+};
+
+#endif // CHIPSIE_CMD_RUNTIME_HPP
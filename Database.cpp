@@ -28,7 +28,13 @@
 using namespace std;
 
 bool Database::Init(const char *db_file) {
-    int rc = sqlite3_open(db_file, &db);
+    // The chat workers all share this one connection
+    if (sqlite3_threadsafe() == 0) {
+        printf("ERROR: sqlite3 was built without thread safety\n");
+        return false;
+    }
+    int rc = sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READWRITE | 
+        SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL);
     if (rc != SQLITE_OK) {
         printf("Failed to open db %s: %d\n", db_file, rc);
         return false;
@@ -269,6 +275,98 @@ void Database::GetCmdResp(const std::string &name, std::string *out_resp) {
     sqlite3_finalize(stmt);
 }
 
+bool Database::LoadMotds(MotdConfig *out_config) {
+    out_config->rate = 20;
+    out_config->enabled = false;
+    out_config->entries.clear();
+
+    sqlite3_stmt *stmt = NULL;
+    string sqlstr = "SELECT rowid, motd, rate, enabled FROM motd ";
+    sqlstr += "ORDER BY rowid";
+    int rc = sqlite3_prepare_v2(db, sqlstr.c_str(), (int)sqlstr.length(), &stmt,
+        NULL);
+    if (rc != SQLITE_OK) {
+        printf("Failed to create motd load statement %d\n", rc);
+        return false;
+    }
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *text = (const char *)sqlite3_column_text(stmt, 1);
+        if (text == NULL) {
+            out_config->rate = (uint32_t)sqlite3_column_int(stmt, 2);
+            out_config->enabled = sqlite3_column_int(stmt, 3) != 0;
+        } else {
+            MotdEntry entry;
+            entry.id = sqlite3_column_int64(stmt, 0);
+            entry.text = text;
+            entry.enabled = sqlite3_column_int(stmt, 3) != 0;
+            out_config->entries.push_back(entry);
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        printf("Failed to load motds from DB: %d\n", rc);
+        return false;
+    }
+    return true;
+}
+
+int64_t Database::AddMotd(const std::string &text) {
+    string mod_text = text;
+    size_t cursor = mod_text.find('\'');
+    while (cursor != string::npos) {
+        mod_text.insert(cursor, 1, '\'');
+        cursor = mod_text.find('\'', cursor + 2);
+    }
+
+    string sqlstr = "INSERT INTO motd (motd, rate, enabled) VALUES (\'";
+    sqlstr += mod_text + "\', 0, 1)";
+    // The connection is shared, an insert from another thread must not get
+    // in between ours and reading its rowid. The mutex is recursive.
+    sqlite3_mutex *mutex = sqlite3_db_mutex(db);
+    sqlite3_mutex_enter(mutex);
+    int64_t id = -1;
+    if (ExecSql(sqlstr)) {
+        id = sqlite3_last_insert_rowid(db);
+    } else {
+        printf("Failed to insert motd into DB\n");
+    }
+    sqlite3_mutex_leave(mutex);
+    return id;
+}
+
+void Database::RemMotd(int64_t id) {
+    string sqlstr = "DELETE FROM motd WHERE rowid = ";
+    sqlstr += std::to_string(id);
+    if (!ExecSql(sqlstr)) printf("Failed to delete motd from DB\n");
+}
+
+void Database::SetMotdRate(uint32_t rate) {
+    string sqlstr = "UPDATE motd SET rate = ";
+    sqlstr += std::to_string(rate);
+    sqlstr += " WHERE motd IS NULL";
+    if (!ExecSql(sqlstr)) printf("Failed to update motd rate in DB\n");
+}
+
+void Database::SetMotdEnabled(bool enabled) {
+    string sqlstr = "UPDATE motd SET enabled = ";
+    sqlstr += enabled ? "1" : "0";
+    sqlstr += " WHERE motd IS NULL";
+    if (!ExecSql(sqlstr)) printf("Failed to update motd state in DB\n");
+}
+
+bool Database::ExecSql(const std::string &sqlstr) {
+    sqlite3_stmt *stmt = NULL;
+    int rc = sqlite3_prepare_v2(db, sqlstr.c_str(), (int)sqlstr.length(), &stmt,
+        NULL);
+    if (rc == SQLITE_OK) rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        printf("SQL statement failed: %d\n", rc);
+        return false;
+    }
+    return true;
+}
+
 bool Database::TableExists(const char *table_name) {
     string sqlstr = "SELECT count(*) FROM sqlite_master WHERE type = 'table' ";
     sqlstr += "AND name ='";
@@ -27,8 +27,22 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include "sqlite3.h"
 
+struct MotdEntry {
+    int64_t id;
+    std::string text;
+    bool enabled; // Disabled ones keep their place but aren't posted
+};
+
+// The motd row without text holds the settings for all of them
+struct MotdConfig {
+    uint32_t rate; // Minutes between two MOTDs
+    bool enabled;
+    std::vector<MotdEntry> entries; // In the order they take turns
+};
+
 class Database {
 public:
     bool Init(const char *db_file);
@@ -39,10 +53,17 @@ public:
     void RemCmd(const std::string &name);
     bool CmdExists(const std::string &name);
     void GetCmdResp(const std::string &name, std::string *out_resp);
+    bool LoadMotds(MotdConfig *out_config);
+    // Returns the new entry's id, or -1 if it couldn't be added
+    int64_t AddMotd(const std::string &text);
+    void RemMotd(int64_t id);
+    void SetMotdRate(uint32_t rate);
+    void SetMotdEnabled(bool enabled);
 private:
     sqlite3 *db;
 
     bool TableExists(const char *table_name);
+    bool ExecSql(const std::string &sqlstr);
 };
 
 #endif // SAT_DATABASE_HPP
\ No newline at end of file
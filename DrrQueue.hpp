@@ -0,0 +1,152 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_DRR_QUEUE_HPP
+#define CHIPSIE_DRR_QUEUE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Queue made of one FIFO per key, e.g. per channel, served by deficit
+// round robin. When a key gets its turn it is credited its share, and it
+// takes one item per credit before the next key is up. A key whose front
+// item can't go right now is passed over and keeps its credit. A key is
+// forgotten as soon as it has nothing queued, only its share is kept. Not
+// thread safe.
+template <typename T>
+class DrrQueue {
+public:
+    typedef std::function<bool(const T &item)> ReadyFunc;
+
+    static const uint32_t DEFAULT_SHARE = 1;
+
+    DrrQueue() {
+        size = 0;
+    }
+
+    void SetShare(const std::string &key, uint32_t share) {
+        share = share > 0 ? share : 1;
+        shares[key] = share;
+        auto it = flows.find(key);
+        if (it != flows.end()) it->second.share = share;
+    }
+
+    void PushBack(const std::string &key, T &&item) {
+        Flow *flow = GetFlow(key);
+        flow->items.push_back(std::move(item));
+        Activate(flow);
+    }
+
+    // For items that were taken but have to go again, ahead of the rest
+    void PushFront(const std::string &key, T &&item) {
+        Flow *flow = GetFlow(key);
+        flow->items.push_front(std::move(item));
+        Activate(flow);
+    }
+
+    size_t GetSize() const { return size; }
+    bool IsEmpty() const { return size == 0; }
+
+    size_t GetSize(const std::string &key) const {
+        auto it = flows.find(key);
+        return it == flows.end() ? 0 : it->second.items.size();
+    }
+
+    // Front item of the key whose turn it is, passing over keys whose front
+    // item ready turns down. NULL if nothing can go. The item stays where
+    // it is until Pop().
+    T *Next(const ReadyFunc &ready) {
+        for (size_t i = 0; i < round.size(); i++) {
+            Flow *flow = round.front();
+            if (flow->deficit == 0) flow->deficit = flow->share;
+            if (ready(flow->items.front())) return &flow->items.front();
+            round.pop_front();
+            round.push_back(flow);
+        }
+        return NULL;
+    }
+
+    // Removes the item Next() returned
+    void Pop() {
+        Flow *flow = round.front();
+        flow->items.pop_front();
+        size--;
+        flow->deficit--;
+        if (flow->items.empty()) {
+            // Credit doesn't carry over an idle spell
+            round.pop_front();
+            flows.erase(flow->key);
+        } else if (flow->deficit == 0) {
+            round.pop_front();
+            round.push_back(flow);
+        }
+    }
+
+    bool HasReady(const ReadyFunc &ready) const {
+        for (size_t i = 0; i < round.size(); i++) {
+            if (ready(round[i]->items.front())) return true;
+        }
+        return false;
+    }
+
+private:
+    struct Flow {
+        std::string key;
+        std::deque<T> items;
+        uint32_t share;
+        uint32_t deficit;
+        bool active; // In the round
+    };
+
+    // Nodes of an unordered_map stay put, so the round can point at them
+    std::unordered_map<std::string, Flow> flows;
+    std::unordered_map<std::string, uint32_t> shares; // Set by SetShare()
+    std::deque<Flow *> round; // Keys with items, the front one has the turn
+    size_t size;
+
+    Flow *GetFlow(const std::string &key) {
+        auto it = flows.find(key);
+        if (it != flows.end()) return &it->second;
+        Flow &flow = flows[key];
+        flow.key = key;
+        auto share = shares.find(key);
+        flow.share = share != shares.end() ? share->second : DEFAULT_SHARE;
+        flow.deficit = 0;
+        flow.active = false;
+        return &flow;
+    }
+
+    void Activate(Flow *flow) {
+        size++;
+        if (flow->active) return;
+        flow->active = true;
+        round.push_back(flow);
+    }
+};
+
+#endif // CHIPSIE_DRR_QUEUE_HPP
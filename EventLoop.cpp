@@ -0,0 +1,233 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "EventLoop.hpp"
+#include <chrono>
+#include <limits.h>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <thread>
+#endif // __linux__
+
+EventLoop::EventLoop() {
+    syscall_count = 0;
+#ifdef __linux__
+    epfd = -1;
+#endif // __linux__
+}
+
+bool EventLoop::Init() {
+    timers.Init(NowMs());
+#ifdef __linux__
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        printf("ERROR: Failed to create epoll instance: %d\n", errno);
+        return false;
+    }
+#endif // __linux__
+    return true;
+}
+
+#ifdef __linux__
+static uint32_t ToEpollEvents(uint32_t events) {
+    uint32_t ep_events = 0;
+    if (events & EV_READ) ep_events |= EPOLLIN | EPOLLRDHUP;
+    if (events & EV_WRITE) ep_events |= EPOLLOUT;
+    return ep_events;
+}
+#endif // __linux__
+
+bool EventLoop::Watch(NetSocket sock, uint32_t events, 
+    const IoHandler &handler) {
+#ifdef __linux__
+    struct epoll_event ev = { };
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = sock;
+    syscall_count++;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) != 0) {
+        printf("WARNING: Failed to add socket to epoll: %d\n", errno);
+        return false;
+    }
+#endif // __linux__
+    Watcher &watcher = watchers[sock];
+    watcher.events = events;
+    watcher.handler = handler;
+    return true;
+}
+
+bool EventLoop::Modify(NetSocket sock, uint32_t events) {
+    auto it = watchers.find(sock);
+    if (it == watchers.end()) return false;
+    if (it->second.events == events) return true;
+#ifdef __linux__
+    struct epoll_event ev = { };
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = sock;
+    syscall_count++;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, sock, &ev) != 0) {
+        printf("WARNING: Failed to modify epoll socket: %d\n", errno);
+        return false;
+    }
+#endif // __linux__
+    it->second.events = events;
+    return true;
+}
+
+void EventLoop::Unwatch(NetSocket sock) {
+    auto it = watchers.find(sock);
+    if (it == watchers.end()) return;
+#ifdef __linux__
+    syscall_count++;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, sock, NULL);
+#endif // __linux__
+    watchers.erase(it);
+}
+
+bool EventLoop::IsWatched(NetSocket sock) const {
+    return watchers.find(sock) != watchers.end();
+}
+
+TimerId EventLoop::AddTimer(uint32_t delay_ms, const TimerHandler &handler) {
+    return timers.Add(NowMs() + delay_ms, handler);
+}
+
+void EventLoop::CancelTimer(TimerId id) {
+    timers.Cancel(id);
+}
+
+void EventLoop::AddPrepareHandler(const PrepareHandler &handler) {
+    prepare_handlers.push_back(handler);
+}
+
+void EventLoop::RunOnce() {
+    for (size_t i = 0; i < prepare_handlers.size(); i++) {
+        prepare_handlers[i]();
+    }
+    int timeout_ms = GetWaitTimeout();
+
+#ifdef __linux__
+    struct epoll_event events[MAX_EVENTS];
+    syscall_count++;
+    int rc = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+    if (rc < 0 && errno != EINTR) {
+        printf("WARNING: epoll wait error %d\n", errno);
+    }
+    for (int i = 0; i < rc; i++) {
+        uint32_t ready = 0;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP)) ready |= EV_READ;
+        if (events[i].events & EPOLLOUT) ready |= EV_WRITE;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) ready |= EV_ERROR;
+        Dispatch(events[i].data.fd, ready);
+    }
+#else
+    fd_set rx_set;
+    fd_set tx_set;
+    fd_set err_set;
+    FD_ZERO(&rx_set);
+    FD_ZERO(&tx_set);
+    FD_ZERO(&err_set);
+    NetSocket max_sock = 0;
+    for (auto &it : watchers) {
+        if (it.second.events & EV_READ) FD_SET(it.first, &rx_set);
+        if (it.second.events & EV_WRITE) FD_SET(it.first, &tx_set);
+        FD_SET(it.first, &err_set);
+        if (it.first > max_sock) max_sock = it.first;
+    }
+
+    if (watchers.empty()) {
+        // select() refuses to wait on nothing, so just sleep to the timer
+        if (timeout_ms < 0) timeout_ms = 1000;
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+    } else {
+        struct timeval tv;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        syscall_count++;
+        int rc = select((int)max_sock + 1, &rx_set, &tx_set, &err_set, 
+            timeout_ms < 0 ? NULL : &tv);
+        if (rc < 0) {
+            printf("WARNING: Socket select error %d\n", NetGetLastError());
+        } else if (rc > 0) {
+            std::vector<std::pair<NetSocket, uint32_t> > ready_list;
+            for (auto &it : watchers) {
+                uint32_t ready = 0;
+                if (FD_ISSET(it.first, &rx_set)) ready |= EV_READ;
+                if (FD_ISSET(it.first, &tx_set)) ready |= EV_WRITE;
+                if (FD_ISSET(it.first, &err_set)) ready |= EV_ERROR;
+                if (ready) ready_list.push_back(std::make_pair(it.first, 
+                    ready));
+            }
+            for (auto &it : ready_list) Dispatch(it.first, it.second);
+        }
+    }
+#endif // __linux__
+
+    timers.RunDue(NowMs());
+}
+
+void EventLoop::Shutdown() {
+    watchers.clear();
+    prepare_handlers.clear();
+    timers.Clear();
+#ifdef __linux__
+    if (epfd >= 0) close(epfd);
+    epfd = -1;
+#endif // __linux__
+}
+
+uint64_t EventLoop::GetSyscallCount() const {
+    return syscall_count;
+}
+
+uint64_t EventLoop::NowMs() {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return (uint64_t)duration_cast<milliseconds>(now).count();
+}
+
+uint64_t EventLoop::NowUs() {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return (uint64_t)duration_cast<microseconds>(now).count();
+}
+
+int EventLoop::GetWaitTimeout() const {
+    uint64_t deadline = 0;
+    if (!timers.GetNextDeadline(&deadline)) return -1;
+    uint64_t now = NowMs();
+    if (deadline <= now) return 0;
+    uint64_t wait = deadline - now;
+    return wait < INT_MAX ? (int)wait : INT_MAX;
+}
+
+void EventLoop::Dispatch(NetSocket sock, uint32_t events) {
+    // Earlier handlers may have unwatched this socket
+    auto it = watchers.find(sock);
+    if (it == watchers.end()) return;
+    IoHandler handler = it->second.handler;
+    handler(events);
+}
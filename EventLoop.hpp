@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_EVENT_LOOP_HPP
+#define CHIPSIE_EVENT_LOOP_HPP
+
+#include "NetPlatform.hpp"
+#include "TimerWheel.hpp"
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+enum EventFlags {
+    EV_READ = 0x1,
+    EV_WRITE = 0x2,
+    EV_ERROR = 0x4
+};
+
+// Single threaded reactor. Sleeps until one of the watched sockets becomes
+// ready or the earliest timer is due, then runs the matching handlers. Uses
+// epoll on Linux and falls back to select() everywhere else. Timers live in
+// a timing wheel, so there can be plenty of them at little cost.
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> IoHandler;
+    typedef std::function<void()> TimerHandler;
+    typedef std::function<void()> PrepareHandler;
+
+    EventLoop();
+    bool Init();
+    bool Watch(NetSocket sock, uint32_t events, const IoHandler &handler);
+    bool Modify(NetSocket sock, uint32_t events);
+    void Unwatch(NetSocket sock);
+    bool IsWatched(NetSocket sock) const;
+    TimerId AddTimer(uint32_t delay_ms, const TimerHandler &handler);
+    void CancelTimer(TimerId id);
+    // Runs right before every wait, e.g. to submit batched I/O
+    void AddPrepareHandler(const PrepareHandler &handler);
+    void RunOnce();
+    void Shutdown();
+    uint64_t GetSyscallCount() const;
+
+    // Monotonic time, only meaningful relative to other calls
+    static uint64_t NowMs();
+    static uint64_t NowUs();
+
+private:
+    static const int MAX_EVENTS = 64;
+
+    struct Watcher {
+        uint32_t events;
+        IoHandler handler;
+    };
+
+    std::unordered_map<NetSocket, Watcher> watchers;
+    TimerWheel timers;
+    std::vector<PrepareHandler> prepare_handlers;
+    uint64_t syscall_count;
+#ifdef __linux__
+    int epfd;
+#endif // __linux__
+
+    int GetWaitTimeout() const;
+    void Dispatch(NetSocket sock, uint32_t events);
+};
+
+#endif // CHIPSIE_EVENT_LOOP_HPP
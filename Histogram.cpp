@@ -0,0 +1,73 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Histogram.hpp"
+#include <string.h>
+
+Histogram::Histogram() {
+    Reset();
+}
+
+void Histogram::Add(uint64_t value) {
+    buckets[GetBucket(value)]++;
+    count++;
+    if (value > max_value) max_value = value;
+}
+
+void Histogram::Reset() {
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    max_value = 0;
+}
+
+uint64_t Histogram::GetPercentile(double pct) const {
+    if (count == 0) return 0;
+    uint64_t target = (uint64_t)(count * pct / 100.0);
+    if (target >= count) target = count - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > target) {
+            uint64_t limit = GetBucketLimit(i);
+            return limit < max_value ? limit : max_value;
+        }
+    }
+    return max_value;
+}
+
+int Histogram::GetBucket(uint64_t value) {
+    if (value < SUB_BUCKETS) return (int)value;
+    int msb = 0;
+    while ((value >> (msb + 1)) != 0) msb++;
+    int shift = msb - SUB_BUCKET_BITS;
+    int sub = (int)((value >> shift) - SUB_BUCKETS);
+    return SUB_BUCKETS + shift * SUB_BUCKETS + sub;
+}
+
+uint64_t Histogram::GetBucketLimit(int bucket) {
+    if (bucket < SUB_BUCKETS) return (uint64_t)bucket;
+    int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+    int sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return (((uint64_t)(SUB_BUCKETS + sub + 1)) << shift) - 1;
+}
@@ -0,0 +1,55 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_HISTOGRAM_HPP
+#define CHIPSIE_HISTOGRAM_HPP
+
+#include <stdint.h>
+
+// Fixed size log-linear histogram. Every power of two is split into eight
+// buckets, so reported percentiles are within 12.5% of the real value.
+class Histogram {
+public:
+    Histogram();
+    void Add(uint64_t value);
+    void Reset();
+    uint64_t GetCount() const { return count; }
+    uint64_t GetMax() const { return max_value; }
+    // Upper bound of the bucket holding the pct-th percentile (0-100)
+    uint64_t GetPercentile(double pct) const;
+
+private:
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int NUM_BUCKETS = SUB_BUCKETS * (64 - SUB_BUCKET_BITS + 1);
+
+    uint64_t buckets[NUM_BUCKETS];
+    uint64_t count;
+    uint64_t max_value;
+
+    static int GetBucket(uint64_t value);
+    static uint64_t GetBucketLimit(int bucket);
+};
+
+#endif // CHIPSIE_HISTOGRAM_HPP
@@ -0,0 +1,48 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "IoEngine.hpp"
+#include "ReactorEngine.hpp"
+#include "UringEngine.hpp"
+#include <stdio.h>
+#include <string.h>
+
+IoEngine *CreateIoEngine(const char *name, EventLoop *loop) {
+#ifdef __linux__
+    if (strcmp(name, "uring") == 0) {
+        UringEngine *engine = new UringEngine(loop);
+        if (engine->Init()) return engine;
+        delete engine;
+        printf("WARNING: io_uring unavailable, using the reactor engine\n");
+        return new ReactorEngine(loop);
+    }
+#endif // __linux__
+    if (strcmp(name, "reactor") != 0) {
+        printf("WARNING: Unknown I/O engine %s, using the reactor\n", name);
+    }
+    return new ReactorEngine(loop);
+}
+
+// Static initializers
+const size_t IoEngine::DEFAULT_RECV_BUDGET;
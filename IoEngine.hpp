@@ -0,0 +1,98 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_IO_ENGINE_HPP
+#define CHIPSIE_IO_ENGINE_HPP
+
+#include "NetPlatform.hpp"
+#include "EventLoop.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+// Receives the results of socket I/O performed by an IoEngine
+class IoClient {
+public:
+    virtual ~IoClient() {}
+    // Where the engine should place the next received bytes
+    virtual char *GetRecvSpace(size_t *out_len) = 0;
+    // len bytes were written to the space handed out by GetRecvSpace. With
+    // 0 the client should work off whatever it still holds, so that
+    // GetRecvSpace has room again.
+    virtual void OnRecv(size_t len) = 0;
+    // The peer closed the connection (err == 0) or the socket failed
+    virtual void OnClosed(int err) = 0;
+    // The engine can accept more data through Send, or has just finished
+    // writing out everything Send took
+    virtual void OnWritable() = 0;
+};
+
+struct IoVec {
+    const char *data;
+    size_t len;
+};
+
+struct IoStats {
+    uint64_t syscalls;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+};
+
+// Moves bytes between connected, non-blocking sockets and their clients. The
+// reactor engine drains a socket with recv until it would block on every
+// readiness event; the io_uring engine batches all of its reads and writes
+// into a single submission per loop pass.
+class IoEngine {
+public:
+    virtual ~IoEngine() {}
+    virtual const char *GetName() const = 0;
+    virtual bool Attach(NetSocket sock, IoClient *client) = 0;
+    // Stops all I/O on sock. The caller still owns and closes the socket.
+    virtual void Detach(NetSocket sock) = 0;
+    // Sends the buffers in order with as few syscalls as possible. Returns
+    // how many bytes were taken (possibly 0), or -1 on failure.
+    virtual int Send(NetSocket sock, const IoVec *vecs, int count) = 0;
+    // Bytes Send took that haven't reached the socket yet. They are lost if
+    // the socket is detached before this drops to 0.
+    virtual size_t GetPendingSend(NetSocket sock) = 0;
+    // Asks for an OnWritable callback once more data can be taken
+    virtual void SetWantWrite(NetSocket sock, bool want_write) = 0;
+    virtual void Shutdown() = 0;
+    const IoStats &GetStats() const { return stats; }
+
+    // Caps how many bytes are read from one socket per wakeup so a single
+    // busy connection can't starve the others
+    void SetRecvBudget(size_t bytes) { recv_budget = bytes; }
+
+    static const size_t DEFAULT_RECV_BUDGET = 65536;
+
+protected:
+    IoStats stats = { };
+    size_t recv_budget = DEFAULT_RECV_BUDGET;
+};
+
+// Creates the engine with the given name ("reactor" or "uring"). Falls back to
+// the reactor if the requested engine is unknown or unavailable.
+IoEngine *CreateIoEngine(const char *name, EventLoop *loop);
+
+#endif // CHIPSIE_IO_ENGINE_HPP
@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "IrcLine.hpp"
+
+bool ParseIrcLine(std::string_view line, IrcLine *out) {
+    const size_t npos = std::string_view::npos;
+    *out = IrcLine();
+
+    size_t cursor = 0;
+    if (!line.empty() && line[0] == '@') {
+        size_t end = line.find(' ');
+        if (end == npos) return false;
+        out->tags = line.substr(1, end - 1);
+        cursor = end + 1;
+    }
+    if (cursor < line.size() && line[cursor] == ':') {
+        size_t end = line.find(' ', cursor);
+        if (end == npos) return false;
+        out->source = line.substr(cursor + 1, end - cursor - 1);
+        cursor = end + 1;
+    }
+    if (cursor >= line.size()) return false;
+
+    size_t end = line.find(' ', cursor);
+    out->command = line.substr(cursor, end - cursor);
+    if (end != npos) out->params = line.substr(end + 1);
+    return !out->command.empty();
+}
+
+std::string_view GetIrcNick(std::string_view source) {
+    return source.substr(0, source.find('!'));
+}
+
+bool GetIrcTag(std::string_view tags, std::string_view key, 
+    std::string_view *out) {
+    const size_t npos = std::string_view::npos;
+    size_t cursor = 0;
+    while (cursor < tags.size()) {
+        size_t end = tags.find(';', cursor);
+        if (end == npos) end = tags.size();
+        std::string_view tag = tags.substr(cursor, end - cursor);
+        size_t eq = tag.find('=');
+        if (tag.substr(0, eq) == key) {
+            *out = eq == npos ? std::string_view() : tag.substr(eq + 1);
+            return true;
+        }
+        cursor = end + 1;
+    }
+    return false;
+}
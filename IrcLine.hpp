@@ -0,0 +1,50 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_IRC_LINE_HPP
+#define CHIPSIE_IRC_LINE_HPP
+
+#include <string_view>
+
+// Zero-copy split of a raw IRC line. The views point into the line, so they
+// are only valid as long as it is.
+struct IrcLine {
+    std::string_view tags; // Without the leading '@'
+    std::string_view source; // Without the leading ':'
+    std::string_view command;
+    std::string_view params;
+};
+
+// Returns false if the line has no command
+bool ParseIrcLine(std::string_view line, IrcLine *out);
+
+// Nick part of a "nick!user@host" source
+std::string_view GetIrcNick(std::string_view source);
+
+// Value of an IRCv3 tag, still escaped. Returns false if the tag is missing,
+// which for ROOMSTATE updates isn't the same as an empty value.
+bool GetIrcTag(std::string_view tags, std::string_view key, 
+    std::string_view *out);
+
+#endif // CHIPSIE_IRC_LINE_HPP
@@ -0,0 +1,207 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "MotdEngine.hpp"
+#include <stdio.h>
+
+MotdEngine::MotdEngine() {
+    db = NULL;
+    tc = NULL;
+    loop = NULL;
+    timer = 0;
+    next_entry = 0;
+    last_post_ms = 0;
+    last_post_chat_count = 0;
+    chat_count = 0;
+    waiting_for_chat = false;
+    shedding = false;
+}
+
+bool MotdEngine::Init(Database *database, TwitchConn *twitch_conn, 
+    EventLoop *event_loop, const std::string &chan) {
+    db = database;
+    tc = twitch_conn;
+    loop = event_loop;
+    channel = chan;
+    if (!db->LoadMotds(&config)) return false;
+    if (!wakeup.Init()) return false;
+    loop->Watch(wakeup.GetHandle(), EV_READ, [this](uint32_t) {
+        wakeup.Clear();
+        Reschedule();
+    });
+
+    int num_disabled = 0;
+    for (size_t i = 0; i < config.entries.size(); i++) {
+        if (!config.entries[i].enabled) num_disabled++;
+    }
+    printf("Loaded %d MOTDs (%d disabled), every %u minutes, %s\n", 
+        (int)config.entries.size(), num_disabled, config.rate, 
+        config.enabled ? "enabled" : "disabled");
+    last_post_ms = EventLoop::NowMs();
+    Reschedule();
+    return true;
+}
+
+void MotdEngine::OnChatMsg(std::string_view chan) {
+    if (chan != channel) return;
+    uint64_t count = ++chat_count;
+    if (!waiting_for_chat || shedding) return;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!waiting_for_chat) return;
+        if (count - last_post_chat_count < MIN_CHAT_MSGS) return;
+        waiting_for_chat = false;
+        Post();
+    }
+    wakeup.Signal();
+}
+
+int64_t MotdEngine::AddMotd(const std::string &text) {
+    int64_t id = db->AddMotd(text);
+    if (id < 0) return 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        MotdEntry entry;
+        entry.id = id;
+        entry.text = text;
+        entry.enabled = true;
+        config.entries.push_back(entry);
+    }
+    wakeup.Signal();
+    return id;
+}
+
+bool MotdEngine::RemMotd(int64_t number) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t index = 0;
+        while (index < config.entries.size() && 
+            config.entries[index].id != number) {
+            index++;
+        }
+        if (index == config.entries.size()) return false;
+        config.entries.erase(config.entries.begin() + index);
+        if (next_entry > index) next_entry--;
+        if (!HasPostable()) waiting_for_chat = false;
+    }
+    db->RemMotd(number);
+    wakeup.Signal();
+    return true;
+}
+
+void MotdEngine::SetRate(uint32_t minutes) {
+    if (minutes < 1) minutes = 1;
+    db->SetMotdRate(minutes);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        config.rate = minutes;
+    }
+    wakeup.Signal();
+}
+
+void MotdEngine::SetEnabled(bool enabled) {
+    db->SetMotdEnabled(enabled);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (enabled && !config.enabled) {
+            // A full interval from now, not right away
+            last_post_ms = EventLoop::NowMs();
+            last_post_chat_count = chat_count;
+        }
+        config.enabled = enabled;
+        if (!enabled) waiting_for_chat = false;
+    }
+    wakeup.Signal();
+}
+
+void MotdEngine::SetShedding(bool shed) {
+    shedding = shed;
+}
+
+void MotdEngine::Shutdown() {
+    if (loop == NULL) return;
+    if (timer != 0) loop->CancelTimer(timer);
+    timer = 0;
+    loop->Unwatch(wakeup.GetHandle());
+    wakeup.Shutdown();
+}
+
+void MotdEngine::Reschedule() {
+    if (timer != 0) {
+        loop->CancelTimer(timer);
+        timer = 0;
+    }
+
+    uint64_t delay_ms = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!config.enabled || !HasPostable()) return;
+        if (waiting_for_chat) return;
+        uint64_t due_ms = last_post_ms + config.rate * 60000ULL;
+        uint64_t now_ms = EventLoop::NowMs();
+        if (due_ms > now_ms) delay_ms = due_ms - now_ms;
+    }
+    timer = loop->AddTimer((uint32_t)delay_ms, [this]() {
+        timer = 0;
+        OnTimer();
+    });
+}
+
+void MotdEngine::OnTimer() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!config.enabled || !HasPostable()) return;
+        if (chat_count - last_post_chat_count < MIN_CHAT_MSGS || shedding) {
+            // OnChatMsg() takes it from here
+            waiting_for_chat = true;
+            return;
+        }
+        Post();
+    }
+    Reschedule();
+}
+
+bool MotdEngine::HasPostable() const {
+    // Called with the lock held
+    for (size_t i = 0; i < config.entries.size(); i++) {
+        if (config.entries[i].enabled) return true;
+    }
+    return false;
+}
+
+void MotdEngine::Post() {
+    // Called with the lock held and HasPostable() true
+    if (next_entry >= config.entries.size()) next_entry = 0;
+    while (!config.entries[next_entry].enabled) {
+        if (++next_entry == config.entries.size()) next_entry = 0;
+    }
+    const MotdEntry &entry = config.entries[next_entry++];
+    tc->SendMsg("PRIVMSG #" + channel + " :" + entry.text);
+    last_post_ms = EventLoop::NowMs();
+    last_post_chat_count = chat_count;
+}
+
+// Static initializers
+const uint64_t MotdEngine::MIN_CHAT_MSGS;
@@ -0,0 +1,92 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_MOTD_ENGINE_HPP
+#define CHIPSIE_MOTD_ENGINE_HPP
+
+#include "Database.hpp"
+#include "EventLoop.hpp"
+#include "TwitchConn.hpp"
+#include "Wakeup.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Posts the messages of the day from the motd table in turn. One goes out
+// once the configured number of minutes has passed and chat has said at
+// least MIN_CHAT_MSGS things since the last one, so the bot doesn't talk
+// to an empty room. The table is read once at startup and kept in sync by
+// the edit calls. Nothing runs while the MOTDs are off or chat is quiet:
+// there is a single timer for the interval, and after that it is chat
+// that triggers the post.
+class MotdEngine {
+public:
+    static const uint64_t MIN_CHAT_MSGS = 5;
+
+    MotdEngine();
+    // loop is the one the timer runs on, the other calls may come from any
+    // thread
+    bool Init(Database *database, TwitchConn *twitch_conn, 
+        EventLoop *event_loop, const std::string &chan);
+    // Only chat in the MOTD channel counts, chan is without the '#'
+    void OnChatMsg(std::string_view chan);
+    // Returns the number of the new MOTD, or 0 if it couldn't be added. The
+    // number is its rowid in the motd table, so it stays the same when
+    // other MOTDs are removed.
+    int64_t AddMotd(const std::string &text);
+    // Takes the number AddMotd() returned
+    bool RemMotd(int64_t number);
+    void SetRate(uint32_t minutes);
+    void SetEnabled(bool enabled);
+    // While chat is backed up the MOTD holds off, and goes out with the
+    // first chat msg after
+    void SetShedding(bool shed);
+    void Shutdown();
+
+private:
+    Database *db;
+    TwitchConn *tc;
+    EventLoop *loop;
+    std::string channel;
+    Wakeup wakeup; // Gets Reschedule() onto the loop's thread
+    TimerId timer; // Loop thread only
+
+    std::mutex lock; // Guards everything below
+    MotdConfig config;
+    size_t next_entry;
+    uint64_t last_post_ms;
+    uint64_t last_post_chat_count;
+    std::atomic<uint64_t> chat_count;
+    std::atomic<bool> waiting_for_chat; // Interval is up, chat isn't
+    std::atomic<bool> shedding;
+
+    void Reschedule();
+    void OnTimer();
+    bool HasPostable() const;
+    void Post();
+};
+
+#endif // CHIPSIE_MOTD_ENGINE_HPP
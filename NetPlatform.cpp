@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "NetPlatform.hpp"
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#endif // _WIN32
+
+bool NetStartup() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    int rc = WSAStartup(MAKEWORD(2,2), &wsaData);
+    if (rc != 0) {
+        printf("ERROR: Failed to initialize Winsock: %d\n", rc);
+        return false;
+    }
+#else
+    // A peer closing on us mid-send should be an error code, not a signal
+    signal(SIGPIPE, SIG_IGN);
+#endif // _WIN32
+    return true;
+}
+
+void NetCleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif // _WIN32
+}
+
+void NetCloseSocket(NetSocket sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif // _WIN32
+}
+
+bool NetSetNonBlocking(NetSocket sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif // _WIN32
+}
+
+int NetGetLastError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif // _WIN32
+}
+
+bool NetWouldBlock(int err) {
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EAGAIN || err == EWOULDBLOCK;
+#endif // _WIN32
+}
+
+bool NetConnectPending(int err) {
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EINPROGRESS;
+#endif // _WIN32
+}
+
+int NetGetSocketError(NetSocket sock) {
+    int err = 0;
+#ifdef _WIN32
+    int len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&err, &len) != 0) {
+        return NetGetLastError();
+    }
+#else
+    socklen_t len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+        return NetGetLastError();
+    }
+#endif // _WIN32
+    return err;
+}
@@ -0,0 +1,69 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_NET_PLATFORM_HPP
+#define CHIPSIE_NET_PLATFORM_HPP
+
+// Thin layer over the native socket API so the rest of Chipsie doesn't need
+// to care whether it is talking to Winsock or to BSD sockets.
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#include <winsock2.h>
+
+typedef SOCKET NetSocket;
+#define NET_INVALID_SOCKET INVALID_SOCKET
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef int NetSocket;
+#define NET_INVALID_SOCKET (-1)
+#endif // _WIN32
+
+// Must be called once before any other networking is done
+bool NetStartup();
+void NetCleanup();
+
+void NetCloseSocket(NetSocket sock);
+bool NetSetNonBlocking(NetSocket sock);
+
+// Returns the error code of the last failed socket call on this thread
+int NetGetLastError();
+
+// True if err means a non-blocking call had nothing to do right now
+bool NetWouldBlock(int err);
+
+// True if err means a non-blocking connect was started but isn't done yet
+bool NetConnectPending(int err);
+
+// Fetches and clears the pending error of sock, e.g. of an async connect
+int NetGetSocketError(NetSocket sock);
+
+#endif // CHIPSIE_NET_PLATFORM_HPP
@@ -0,0 +1,144 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ReactorEngine.hpp"
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif // _WIN32
+
+ReactorEngine::ReactorEngine(EventLoop *event_loop) {
+    loop = event_loop;
+}
+
+const char *ReactorEngine::GetName() const {
+    return "reactor";
+}
+
+bool ReactorEngine::Attach(NetSocket sock, IoClient *client) {
+    return loop->Watch(sock, EV_READ, [this, sock, client](uint32_t events) {
+        OnSocketEvent(sock, client, events);
+    });
+}
+
+void ReactorEngine::Detach(NetSocket sock) {
+    loop->Unwatch(sock);
+}
+
+int ReactorEngine::Send(NetSocket sock, const IoVec *vecs, int count) {
+    if (count > MAX_VECS) count = MAX_VECS;
+
+    // One gathered write for everything; a short write just means the
+    // socket buffer is full, so there is no point in trying again right away
+    stats.syscalls++;
+#ifdef _WIN32
+    WSABUF bufs[MAX_VECS];
+    for (int i = 0; i < count; i++) {
+        bufs[i].buf = (char *)vecs[i].data;
+        bufs[i].len = (ULONG)vecs[i].len;
+    }
+    DWORD bytes_sent = 0;
+    int rc = WSASend(sock, bufs, (DWORD)count, &bytes_sent, 0, NULL, NULL);
+    if (rc != 0) {
+        if (NetWouldBlock(NetGetLastError())) return 0;
+        return -1;
+    }
+#else
+    struct iovec iovs[MAX_VECS];
+    for (int i = 0; i < count; i++) {
+        iovs[i].iov_base = (void *)vecs[i].data;
+        iovs[i].iov_len = vecs[i].len;
+    }
+    struct msghdr msg = { };
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = count;
+    ssize_t bytes_sent = sendmsg(sock, &msg, 0);
+    if (bytes_sent < 0) {
+        if (NetWouldBlock(NetGetLastError())) return 0;
+        return -1;
+    }
+#endif // _WIN32
+    stats.tx_bytes += bytes_sent;
+    return (int)bytes_sent;
+}
+
+size_t ReactorEngine::GetPendingSend(NetSocket sock) {
+    // Send writes straight to the socket, the kernel owns whatever it took
+    (void)sock;
+    return 0;
+}
+
+void ReactorEngine::SetWantWrite(NetSocket sock, bool want_write) {
+    uint32_t events = EV_READ;
+    if (want_write) events |= EV_WRITE;
+    loop->Modify(sock, events);
+}
+
+void ReactorEngine::Shutdown() {
+
+}
+
+void ReactorEngine::OnSocketEvent(NetSocket sock, IoClient *client, 
+    uint32_t events) {
+    if (events & EV_ERROR) {
+        client->OnClosed(NetGetSocketError(sock));
+        return;
+    }
+
+    if (events & EV_READ) {
+        // Keep reading until the socket is empty or this wakeup's budget is
+        // used up. Anything left over is reported again by the next wait.
+        size_t budget = recv_budget;
+        while (budget > 0) {
+            size_t space = 0;
+            char *buffer = client->GetRecvSpace(&space);
+            if (space == 0) break;
+            if (space > budget) space = budget;
+            stats.syscalls++;
+            int rc = (int)recv(sock, buffer, (int)space, 0);
+            if (rc == 0) {
+                client->OnClosed(0);
+                return;
+            } else if (rc < 0) {
+                int err = NetGetLastError();
+                if (NetWouldBlock(err)) break;
+                client->OnClosed(err);
+                return;
+            }
+            stats.rx_bytes += rc;
+            budget -= rc;
+            client->OnRecv((size_t)rc);
+            if (!loop->IsWatched(sock)) return;
+
+            // A short read means the kernel buffer is empty, which saves the
+            // extra recv that would only return EAGAIN
+            if ((size_t)rc < space) break;
+        }
+    }
+
+    if (events & EV_WRITE) {
+        client->OnWritable();
+    }
+}
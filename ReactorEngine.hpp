@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_REACTOR_ENGINE_HPP
+#define CHIPSIE_REACTOR_ENGINE_HPP
+
+#include "IoEngine.hpp"
+
+// Readiness based engine: waits for the event loop to report a socket as
+// readable or writable and then performs the matching syscall.
+class ReactorEngine : public IoEngine {
+public:
+    explicit ReactorEngine(EventLoop *event_loop);
+    const char *GetName() const override;
+    bool Attach(NetSocket sock, IoClient *client) override;
+    void Detach(NetSocket sock) override;
+    int Send(NetSocket sock, const IoVec *vecs, int count) override;
+    size_t GetPendingSend(NetSocket sock) override;
+    void SetWantWrite(NetSocket sock, bool want_write) override;
+    void Shutdown() override;
+
+    static const int MAX_VECS = 128;
+
+private:
+    EventLoop *loop;
+
+    void OnSocketEvent(NetSocket sock, IoClient *client, uint32_t events);
+};
+
+#endif // CHIPSIE_REACTOR_ENGINE_HPP
@@ -0,0 +1,195 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Resolver.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+Resolver::Resolver() {
+    loop = NULL;
+    expire_ms = 0;
+}
+
+void Resolver::Init(const char *host_name, const char *port_name, 
+    EventLoop *event_loop) {
+    host = host_name;
+    port = port_name;
+    loop = event_loop;
+    lookup_addrs.clear();
+    failed_addrs.clear();
+    addrs.clear();
+    expire_ms = 0;
+
+    // Warm the cache so the first connect doesn't have to wait on DNS
+    StartLookup();
+}
+
+void Resolver::Resolve(const ResolveHandler &handler) {
+    if (EventLoop::NowMs() >= expire_ms) StartLookup();
+    if (!addrs.empty() || !lookup) { // Cached, or the lookup didn't start
+        pending_handler = nullptr;
+        handler(addrs);
+        return;
+    }
+    pending_handler = handler;
+}
+
+void Resolver::CancelResolve() {
+    pending_handler = nullptr;
+}
+
+void Resolver::Invalidate() {
+    expire_ms = 0;
+}
+
+void Resolver::MarkFailed(const ResolvedAddr &addr) {
+    // Failing again makes it the most recent failure
+    MarkConnected(addr);
+    failed_addrs.push_back(addr);
+    SortAddrs();
+}
+
+void Resolver::MarkConnected(const ResolvedAddr &addr) {
+    for (size_t i = 0; i < failed_addrs.size(); i++) {
+        if (!SameAddr(failed_addrs[i], addr)) continue;
+        failed_addrs.erase(failed_addrs.begin() + i);
+        SortAddrs();
+        return;
+    }
+}
+
+void Resolver::Shutdown() {
+    // A lookup still running just finishes into its own shared state
+    if (lookup) loop->Unwatch(lookup->wakeup.GetHandle());
+    lookup.reset();
+    pending_handler = nullptr;
+}
+
+void Resolver::StartLookup() {
+    if (lookup) return;
+    std::shared_ptr<Lookup> started = std::make_shared<Lookup>();
+    if (!started->wakeup.Init()) {
+        printf("WARNING: Failed to set up the DNS lookup wakeup\n");
+        return;
+    }
+    started->host = host;
+    started->port = port;
+    started->done = false;
+    started->err = 0;
+    lookup = started;
+    loop->Watch(lookup->wakeup.GetHandle(), EV_READ, 
+        [this](uint32_t) { FinishLookup(); });
+    std::thread(RunLookup, lookup).detach();
+}
+
+void Resolver::FinishLookup() {
+    lookup->wakeup.Clear();
+    {
+        std::lock_guard<std::mutex> guard(lookup->lock);
+        if (!lookup->done) return;
+    }
+
+    loop->Unwatch(lookup->wakeup.GetHandle());
+    std::shared_ptr<Lookup> result = lookup;
+    lookup.reset();
+    if (result->err != 0 || result->addrs.empty()) {
+        printf("WARNING: Failed to resolve %s: %d\n", host.c_str(), 
+            result->err);
+        // Keep serving whatever was cached before, retry on the next use
+        expire_ms = 0;
+    } else {
+        // A fresh list gives the addresses that failed before another go
+        failed_addrs.clear();
+        lookup_addrs.swap(result->addrs);
+        SortAddrs();
+        expire_ms = EventLoop::NowMs() + CACHE_TTL_MS;
+    }
+
+    if (pending_handler) {
+        ResolveHandler handler = pending_handler;
+        pending_handler = nullptr;
+        handler(addrs);
+    }
+}
+
+void Resolver::RunLookup(std::shared_ptr<Lookup> lookup) {
+    struct addrinfo hints = { };
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    struct addrinfo *results = NULL;
+    int rc = getaddrinfo(lookup->host.c_str(), lookup->port.c_str(), &hints,
+        &results);
+
+    std::vector<ResolvedAddr> found;
+    for (struct addrinfo *it = results; rc == 0 && it != NULL; 
+        it = it->ai_next) {
+        if (it->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+        ResolvedAddr addr = { };
+        memcpy(&addr.addr, it->ai_addr, it->ai_addrlen);
+        addr.addr_len = (socklen_t)it->ai_addrlen;
+        addr.family = it->ai_family;
+        found.push_back(addr);
+    }
+    if (results != NULL) freeaddrinfo(results);
+
+    {
+        std::lock_guard<std::mutex> guard(lookup->lock);
+        lookup->err = rc;
+        lookup->addrs.swap(found);
+        lookup->done = true;
+    }
+    lookup->wakeup.Signal();
+}
+
+void Resolver::SortAddrs() {
+    addrs.clear();
+    for (size_t i = 0; i < lookup_addrs.size(); i++) {
+        if (!IsFailed(lookup_addrs[i])) addrs.push_back(lookup_addrs[i]);
+    }
+    // Skip failures of addresses the last lookup no longer returned
+    for (size_t i = 0; i < failed_addrs.size(); i++) {
+        for (size_t j = 0; j < lookup_addrs.size(); j++) {
+            if (!SameAddr(lookup_addrs[j], failed_addrs[i])) continue;
+            addrs.push_back(failed_addrs[i]);
+            break;
+        }
+    }
+}
+
+bool Resolver::IsFailed(const ResolvedAddr &addr) const {
+    for (size_t i = 0; i < failed_addrs.size(); i++) {
+        if (SameAddr(failed_addrs[i], addr)) return true;
+    }
+    return false;
+}
+
+bool Resolver::SameAddr(const ResolvedAddr &a, const ResolvedAddr &b) {
+    return a.addr_len == b.addr_len && 
+        memcmp(&a.addr, &b.addr, a.addr_len) == 0;
+}
+
+// Static initializers
+const uint32_t Resolver::CACHE_TTL_MS;
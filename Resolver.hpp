@@ -0,0 +1,105 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_RESOLVER_HPP
+#define CHIPSIE_RESOLVER_HPP
+
+#include "NetPlatform.hpp"
+#include "EventLoop.hpp"
+#include "Wakeup.hpp"
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ResolvedAddr {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int family;
+};
+
+// Caches the addresses of a single host. Lookups run getaddrinfo on a
+// background thread so the event loop never blocks on DNS. Once the cache
+// expires the old addresses keep being handed out while a refresh runs.
+// Addresses that fail to connect are rotated to the back of the list until
+// they connect again, which puts them back in their lookup order, or the
+// cache is refreshed.
+class Resolver {
+public:
+    // Called on the event loop thread, addrs is empty if the lookup failed
+    typedef std::function<void(const std::vector<ResolvedAddr> &addrs)>
+        ResolveHandler;
+
+    Resolver();
+    void Init(const char *host, const char *port, EventLoop *event_loop);
+    // Calls handler right away if anything is cached, otherwise once the
+    // lookup finished. Only the most recent handler is kept.
+    void Resolve(const ResolveHandler &handler);
+    void CancelResolve();
+    // Forces a refresh on the next Resolve, e.g. when nothing connected
+    void Invalidate();
+    void MarkFailed(const ResolvedAddr &addr);
+    void MarkConnected(const ResolvedAddr &addr);
+    void Shutdown();
+
+private:
+    // getaddrinfo doesn't report the record TTL, so use a conservative one
+    static const uint32_t CACHE_TTL_MS = 300000;
+
+    // Shared with the lookup thread, which may outlive the resolver if
+    // getaddrinfo hangs at shutdown. The wakeup is closed by whichever of
+    // the two lets go last, so the thread never signals a closed handle.
+    struct Lookup {
+        Wakeup wakeup; // Signaled by the thread once it is done
+        std::mutex lock; // Guards the fields below host and port
+        std::string host;
+        std::string port;
+        bool done;
+        int err;
+        std::vector<ResolvedAddr> addrs;
+
+        ~Lookup() { wakeup.Shutdown(); }
+    };
+
+    std::string host;
+    std::string port;
+    EventLoop *loop;
+    std::vector<ResolvedAddr> lookup_addrs; // In the order getaddrinfo gave
+    std::vector<ResolvedAddr> failed_addrs; // Oldest failure first
+    std::vector<ResolvedAddr> addrs; // The two above, failed ones last
+    uint64_t expire_ms;
+    std::shared_ptr<Lookup> lookup;
+    ResolveHandler pending_handler;
+
+    void StartLookup();
+    void FinishLookup();
+    static void RunLookup(std::shared_ptr<Lookup> lookup);
+    void SortAddrs();
+    bool IsFailed(const ResolvedAddr &addr) const;
+    static bool SameAddr(const ResolvedAddr &a, const ResolvedAddr &b);
+};
+
+#endif // CHIPSIE_RESOLVER_HPP
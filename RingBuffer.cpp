@@ -0,0 +1,137 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "RingBuffer.hpp"
+#include <string.h>
+
+RingBuffer::RingBuffer(size_t initial_capacity) {
+    size_t capacity = 1;
+    while (capacity < initial_capacity) capacity <<= 1;
+    storage.resize(capacity);
+    mask = capacity - 1;
+    read_pos = 0;
+    write_pos = 0;
+}
+
+char *RingBuffer::GetWriteSpace(size_t min_len, size_t *out_len) {
+    if (storage.size() - GetSize() < min_len) Grow(min_len);
+    size_t index = (size_t)(write_pos & mask);
+    size_t free_bytes = storage.size() - GetSize();
+    size_t to_end = storage.size() - index;
+    *out_len = free_bytes < to_end ? free_bytes : to_end;
+    return &storage[index];
+}
+
+void RingBuffer::CommitWrite(size_t len) {
+    write_pos += len;
+}
+
+void RingBuffer::Write(const char *data, size_t len) {
+    while (len > 0) {
+        size_t space = 0;
+        char *dest = GetWriteSpace(len, &space);
+        if (space > len) space = len;
+        memcpy(dest, data, space);
+        CommitWrite(space);
+        data += space;
+        len -= space;
+    }
+}
+
+int RingBuffer::GetReadSegments(const char *out_data[2], 
+    size_t out_len[2]) const {
+    size_t size = GetSize();
+    if (size == 0) return 0;
+    size_t index = (size_t)(read_pos & mask);
+    size_t to_end = storage.size() - index;
+    out_data[0] = &storage[index];
+    if (size <= to_end) {
+        out_len[0] = size;
+        return 1;
+    }
+    out_len[0] = to_end;
+    out_data[1] = &storage[0];
+    out_len[1] = size - to_end;
+    return 2;
+}
+
+void RingBuffer::ConsumeTo(uint64_t pos) {
+    if (pos > write_pos) pos = write_pos;
+    if (pos > read_pos) read_pos = pos;
+}
+
+void RingBuffer::Clear() {
+    read_pos = write_pos;
+}
+
+bool RingBuffer::Find(char c, uint64_t from, uint64_t *out_pos) const {
+    if (from < read_pos) from = read_pos;
+    while (from < write_pos) {
+        size_t index = (size_t)(from & mask);
+        size_t len = (size_t)(write_pos - from);
+        if (len > storage.size() - index) len = storage.size() - index;
+        const char *start = &storage[index];
+        const char *hit = (const char *)memchr(start, c, len);
+        if (hit != NULL) {
+            *out_pos = from + (uint64_t)(hit - start);
+            return true;
+        }
+        from += len;
+    }
+    return false;
+}
+
+std::string_view RingBuffer::View(uint64_t pos, size_t len, 
+    std::string *scratch) const {
+    size_t index = (size_t)(pos & mask);
+    if (index + len <= storage.size()) {
+        return std::string_view(&storage[index], len);
+    }
+    size_t first = storage.size() - index;
+    scratch->assign(&storage[index], first);
+    scratch->append(&storage[0], len - first);
+    return std::string_view(*scratch);
+}
+
+void RingBuffer::Grow(size_t min_free) {
+    size_t size = GetSize();
+    size_t capacity = storage.size();
+    while (capacity - size < min_free) capacity <<= 1;
+
+    // Re-home every unread byte at its position modulo the new capacity
+    std::vector<char> new_storage(capacity);
+    size_t new_mask = capacity - 1;
+    uint64_t pos = read_pos;
+    while (pos < write_pos) {
+        size_t index = (size_t)(pos & mask);
+        size_t new_index = (size_t)(pos & new_mask);
+        size_t len = (size_t)(write_pos - pos);
+        if (len > storage.size() - index) len = storage.size() - index;
+        if (len > capacity - new_index) len = capacity - new_index;
+        memcpy(&new_storage[new_index], &storage[index], len);
+        pos += len;
+    }
+    storage.swap(new_storage);
+    mask = new_mask;
+}
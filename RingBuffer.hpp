@@ -0,0 +1,82 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_RING_BUFFER_HPP
+#define CHIPSIE_RING_BUFFER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Growable byte ring. Bytes are addressed by their absolute position in the
+// stream (the number of bytes written before them), which stays stable when
+// the ring grows or wraps.
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t initial_capacity = 16384);
+
+    size_t GetSize() const { return (size_t)(write_pos - read_pos); }
+    size_t GetCapacity() const { return storage.size(); }
+    uint64_t GetReadPos() const { return read_pos; }
+    uint64_t GetWritePos() const { return write_pos; }
+
+    // Returns contiguous free space for the next write, growing the ring
+    // first if less than min_len bytes are free
+    char *GetWriteSpace(size_t min_len, size_t *out_len);
+    void CommitWrite(size_t len);
+
+    // Appends len bytes, growing as needed
+    void Write(const char *data, size_t len);
+
+    // Fills in up to two runs that together cover every unread byte and
+    // returns how many were needed
+    int GetReadSegments(const char *out_data[2], size_t out_len[2]) const;
+
+    // Frees everything before pos
+    void ConsumeTo(uint64_t pos);
+    void Clear();
+
+    char At(uint64_t pos) const { return storage[pos & mask]; }
+
+    // Searches [from, write position) for c. Uses memchr on each contiguous
+    // segment, which libc vectorizes.
+    bool Find(char c, uint64_t from, uint64_t *out_pos) const;
+
+    // Returns a view of [pos, pos + len). Only a range that wraps around the
+    // end of the storage is copied, into scratch.
+    std::string_view View(uint64_t pos, size_t len, 
+        std::string *scratch) const;
+
+private:
+    std::vector<char> storage;
+    size_t mask;
+    uint64_t read_pos;
+    uint64_t write_pos;
+
+    void Grow(size_t min_free);
+};
+
+#endif // CHIPSIE_RING_BUFFER_HPP
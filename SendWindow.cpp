@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "SendWindow.hpp"
+
+SendWindow::SendWindow() {
+    window = 0;
+}
+
+void SendWindow::SetWindow(uint32_t window_ms) {
+    window = window_ms;
+}
+
+bool SendWindow::TrySend(uint64_t now_ms, uint32_t limit) {
+    if (GetNextFreeMs(now_ms, limit) > now_ms) return false;
+    sent_ms.push_back(now_ms);
+    return true;
+}
+
+uint64_t SendWindow::GetNextFreeMs(uint64_t now_ms, uint32_t limit) {
+    Expire(now_ms);
+    if (sent_ms.size() < limit) return now_ms;
+    if (limit == 0) return UINT64_MAX;
+    // Once this one drops out, one fewer than the limit are in the window
+    return sent_ms[sent_ms.size() - limit] + window;
+}
+
+uint32_t SendWindow::GetSent(uint64_t now_ms) {
+    Expire(now_ms);
+    return (uint32_t)sent_ms.size();
+}
+
+void SendWindow::Expire(uint64_t now_ms) {
+    while (!sent_ms.empty() && sent_ms.front() + window <= now_ms) {
+        sent_ms.pop_front();
+    }
+}
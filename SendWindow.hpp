@@ -0,0 +1,54 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_SEND_WINDOW_HPP
+#define CHIPSIE_SEND_WINDOW_HPP
+
+#include <stdint.h>
+#include <deque>
+
+// Rate limit in the form Twitch states its limits: at most so many sends in
+// any window. A sliding log of the send times rather than a token bucket,
+// so a send only frees up its slot exactly one window later and there is
+// no refill to burst from. That makes it possible to use the whole limit
+// without ever going over it. The limit is passed in with every call,
+// since it can change from one msg to the next.
+class SendWindow {
+public:
+    SendWindow();
+    void SetWindow(uint32_t window_ms);
+    bool TrySend(uint64_t now_ms, uint32_t limit);
+    // When the next send fits, now_ms if it already does
+    uint64_t GetNextFreeMs(uint64_t now_ms, uint32_t limit);
+    // Sends in the past window
+    uint32_t GetSent(uint64_t now_ms);
+
+private:
+    uint32_t window;
+    std::deque<uint64_t> sent_ms; // Oldest first
+
+    void Expire(uint64_t now_ms);
+};
+
+#endif // CHIPSIE_SEND_WINDOW_HPP
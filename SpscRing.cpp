@@ -0,0 +1,118 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "SpscRing.hpp"
+#include <string.h>
+
+SpscRing::SpscRing(size_t capacity) {
+    size_t size = 64;
+    while (size < capacity) size <<= 1;
+    storage.resize(size);
+    mask = size - 1;
+    write_count = 0;
+    write_pos = 0;
+    pending_pos = 0;
+    pending_len = 0;
+    read_pos = 0;
+    pop_count = 0;
+    held_end = 0;
+    producer_blocked = false;
+}
+
+size_t SpscRing::GetRecordSize(size_t len) {
+    // Length header, then the data padded so the next header is aligned
+    return sizeof(uint32_t) + ((len + 3) & ~(size_t)3);
+}
+
+char *SpscRing::BeginWrite(size_t len) {
+    size_t record_size = GetRecordSize(len);
+    size_t index = (size_t)(write_pos & mask);
+    size_t to_end = storage.size() - index;
+    size_t needed = record_size;
+    if (record_size > to_end) needed += to_end; // Skip to the start
+    if (needed > storage.size()) return NULL;
+
+    uint64_t used = write_pos - read_pos.load(std::memory_order_acquire);
+    if (storage.size() - used < needed) {
+        // Flag first and look again, otherwise the consumer could free
+        // everything in between and never know to wake us up
+        producer_blocked.store(true, std::memory_order_seq_cst);
+        used = write_pos - read_pos.load(std::memory_order_seq_cst);
+        if (storage.size() - used < needed) return NULL;
+        producer_blocked.store(false, std::memory_order_relaxed);
+    }
+
+    pending_pos = write_pos;
+    if (record_size > to_end) {
+        uint32_t marker = WRAP_MARKER;
+        memcpy(&storage[index], &marker, sizeof(marker));
+        pending_pos += to_end;
+    }
+    pending_len = len;
+    return &storage[(size_t)(pending_pos & mask) + sizeof(uint32_t)];
+}
+
+bool SpscRing::CommitWrite() {
+    uint32_t len = (uint32_t)pending_len;
+    memcpy(&storage[(size_t)(pending_pos & mask)], &len, sizeof(len));
+    write_pos = pending_pos + GetRecordSize(pending_len);
+
+    uint64_t count = write_count.load(std::memory_order_relaxed);
+    write_count.store(count + 1, std::memory_order_seq_cst);
+    return pop_count.load(std::memory_order_seq_cst) == count;
+}
+
+bool SpscRing::Pop(std::string_view *out) {
+    uint64_t pos = held_end;
+    read_pos.store(pos, std::memory_order_seq_cst);
+
+    uint64_t count = pop_count.load(std::memory_order_relaxed);
+    if (count == write_count.load(std::memory_order_seq_cst)) return false;
+
+    size_t index = (size_t)(pos & mask);
+    uint32_t len = 0;
+    memcpy(&len, &storage[index], sizeof(len));
+    if (len == WRAP_MARKER) {
+        pos += storage.size() - index;
+        index = 0;
+        memcpy(&len, &storage[0], sizeof(len));
+    }
+    *out = std::string_view(&storage[index + sizeof(uint32_t)], len);
+    held_end = pos + GetRecordSize(len);
+    pop_count.store(count + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+size_t SpscRing::GetCount() const {
+    return (size_t)(write_count.load(std::memory_order_acquire) -
+        pop_count.load(std::memory_order_relaxed));
+}
+
+bool SpscRing::TakeBlockedProducer() {
+    if (!producer_blocked.load(std::memory_order_seq_cst)) return false;
+    return producer_blocked.exchange(false);
+}
+
+// Static initializers
+const uint32_t SpscRing::WRAP_MARKER;
@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_SPSC_RING_HPP
+#define CHIPSIE_SPSC_RING_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string_view>
+#include <vector>
+
+// Bounded lock-free queue of variable length records between exactly one
+// producer thread and one consumer thread. Records are stored contiguously,
+// so the consumer reads them in place without copying.
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity);
+
+    // Producer side. Returns space for a len byte record, or NULL if the
+    // ring is full. In that case the consumer's TakeBlockedProducer() turns
+    // true once it has freed up space.
+    char *BeginWrite(size_t len);
+    // Publishes the record. Returns true if the consumer had already taken
+    // every earlier record and may be asleep waiting for this one.
+    bool CommitWrite();
+
+    // Consumer side. The returned record stays valid until the next call,
+    // which is also what frees its space.
+    bool Pop(std::string_view *out);
+    size_t GetCount() const;
+    bool TakeBlockedProducer();
+
+private:
+    static const uint32_t WRAP_MARKER = 0xFFFFFFFF;
+
+    std::vector<char> storage;
+    size_t mask;
+
+    // Each side's counters on their own cache line so the threads don't
+    // fight over them
+    alignas(64) std::atomic<uint64_t> write_count;
+    uint64_t write_pos; // Producer only
+    uint64_t pending_pos; // Start of the record between Begin and Commit
+    size_t pending_len;
+
+    alignas(64) std::atomic<uint64_t> read_pos; // Space before this is free
+    std::atomic<uint64_t> pop_count;
+    uint64_t held_end; // End of the record the consumer is looking at
+
+    alignas(64) std::atomic<bool> producer_blocked;
+
+    static size_t GetRecordSize(size_t len);
+};
+
+#endif // CHIPSIE_SPSC_RING_HPP
@@ -0,0 +1,247 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "TimerWheel.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+TimerWheel::TimerWheel() {
+    for (int level = 0; level < LEVELS; level++) {
+        for (int slot = 0; slot < SLOTS; slot++) InitList(&slots[level][slot]);
+        occupied[level] = 0;
+    }
+    InitList(&due);
+    current_tick = 0;
+    next_id = 1;
+}
+
+TimerWheel::~TimerWheel() {
+    Clear();
+}
+
+void TimerWheel::Init(uint64_t now_ms) {
+    Clear();
+    current_tick = now_ms;
+}
+
+TimerId TimerWheel::Add(uint64_t deadline_ms, const Handler &handler) {
+    Timer *timer = new Timer();
+    timer->id = next_id++;
+    timer->deadline = deadline_ms;
+    timer->handler = handler;
+    if (deadline_ms <= current_tick) {
+        // Its tick went by already, run it on the next pass
+        timer->level = -1;
+        timer->slot = 0;
+        Append(&due, timer);
+    } else {
+        Insert(timer);
+    }
+    lookup[timer->id] = timer;
+    return timer->id;
+}
+
+void TimerWheel::Cancel(TimerId id) {
+    auto it = lookup.find(id);
+    if (it == lookup.end()) return;
+    Timer *timer = it->second;
+    lookup.erase(it);
+    Remove(timer);
+    delete timer;
+}
+
+bool TimerWheel::GetNextDeadline(uint64_t *out_deadline_ms) const {
+    if (due.next != &due) {
+        *out_deadline_ms = current_tick;
+        return true;
+    }
+    return GetNextWork(out_deadline_ms, true);
+}
+
+void TimerWheel::RunDue(uint64_t now_ms) {
+    Link list;
+    InitList(&list);
+    MoveList(&due, &list);
+    RunList(&list);
+
+    while (current_tick < now_ms) {
+        uint64_t tick = 0;
+        if (!GetNextWork(&tick, false) || tick > now_ms) {
+            current_tick = now_ms;
+            break;
+        }
+
+        // Higher levels first, whatever they hand down may belong in the
+        // lower slots that come up at this same tick
+        current_tick = tick;
+        for (int level = LEVELS - 1; level > 0; level--) {
+            uint64_t low_mask = (1ULL << (level * SLOT_BITS)) - 1;
+            if ((tick & low_mask) == 0) Cascade(level);
+        }
+        int slot = (int)(tick & (SLOTS - 1));
+        MoveList(&slots[0][slot], &list);
+        occupied[0] &= ~(1ULL << slot);
+        RunList(&list);
+    }
+}
+
+void TimerWheel::Clear() {
+    for (auto &it : lookup) {
+        Unlink(it.second);
+        delete it.second;
+    }
+    lookup.clear();
+    for (int level = 0; level < LEVELS; level++) occupied[level] = 0;
+}
+
+void TimerWheel::Insert(Timer *timer) {
+    // The highest 6 bit group where the deadline differs from the current
+    // tick picks the level. The deadline is later, so its slot on that
+    // level is still ahead of the current one.
+    uint64_t diff = timer->deadline ^ current_tick;
+    int level = 0;
+    while (level < LEVELS - 1 && (diff >> ((level + 1) * SLOT_BITS)) != 0) {
+        level++;
+    }
+    int slot = (int)((timer->deadline >> (level * SLOT_BITS)) & (SLOTS - 1));
+    timer->level = level;
+    timer->slot = slot;
+    Append(&slots[level][slot], timer);
+    occupied[level] |= 1ULL << slot;
+}
+
+void TimerWheel::Remove(Timer *timer) {
+    Unlink(timer);
+    if (timer->level < 0) return;
+    Link *list = &slots[timer->level][timer->slot];
+    if (list->next == list) occupied[timer->level] &= ~(1ULL << timer->slot);
+}
+
+bool TimerWheel::GetNextWork(uint64_t *out_tick, bool exact) const {
+    // Every timer on a level comes before the first occupied slot of the
+    // level above, so the lowest level with anything ahead has the answer
+    for (int level = 0; level < LEVELS; level++) {
+        int shift = level * SLOT_BITS;
+        int current = (int)((current_tick >> shift) & (SLOTS - 1));
+        int slot = FindNextSlot(occupied[level], current);
+        if (slot < 0) continue;
+
+        // The tick the slot comes up on
+        uint64_t base = current_tick;
+        if (shift + SLOT_BITS < 64) {
+            base &= ~((1ULL << (shift + SLOT_BITS)) - 1);
+        } else {
+            base = 0;
+        }
+        uint64_t tick = base | ((uint64_t)slot << shift);
+        if (level > 0 && exact) {
+            // Timers in a slot share the slot's range, not the deadline
+            const Link *list = &slots[level][slot];
+            for (const Link *it = list->next; it != list; it = it->next) {
+                uint64_t deadline = static_cast<const Timer *>(it)->deadline;
+                if (it == list->next || deadline < tick) tick = deadline;
+            }
+        }
+        *out_tick = tick;
+        return true;
+    }
+    return false;
+}
+
+void TimerWheel::Cascade(int level) {
+    int shift = level * SLOT_BITS;
+    int slot = (int)((current_tick >> shift) & (SLOTS - 1));
+    Link list;
+    InitList(&list);
+    MoveList(&slots[level][slot], &list);
+    occupied[level] &= ~(1ULL << slot);
+    while (list.next != &list) {
+        Timer *timer = static_cast<Timer *>(list.next);
+        Unlink(timer);
+        Insert(timer);
+    }
+}
+
+void TimerWheel::RunList(Link *list) {
+    // Handlers may cancel timers still in the list, so take them one at a
+    // time instead of walking it
+    while (list->next != list) {
+        Timer *timer = static_cast<Timer *>(list->next);
+        Unlink(timer);
+        lookup.erase(timer->id);
+        Handler handler = std::move(timer->handler);
+        delete timer;
+        handler();
+    }
+}
+
+void TimerWheel::InitList(Link *list) {
+    list->prev = list;
+    list->next = list;
+}
+
+void TimerWheel::Append(Link *list, Link *item) {
+    item->prev = list->prev;
+    item->next = list;
+    list->prev->next = item;
+    list->prev = item;
+}
+
+void TimerWheel::Unlink(Link *item) {
+    item->prev->next = item->next;
+    item->next->prev = item->prev;
+    item->prev = item;
+    item->next = item;
+}
+
+void TimerWheel::MoveList(Link *from, Link *to) {
+    if (from->next == from) return;
+    Link *first = from->next;
+    Link *last = from->prev;
+    first->prev = to->prev;
+    to->prev->next = first;
+    last->next = to;
+    to->prev = last;
+    InitList(from);
+}
+
+int TimerWheel::FindNextSlot(uint64_t bits, int after) {
+    if (after >= SLOTS - 1) return -1;
+    bits &= ~((2ULL << after) - 1);
+    if (bits == 0) return -1;
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif // _MSC_VER
+}
+
+// Static initializers
+const int TimerWheel::SLOT_BITS;
+const int TimerWheel::SLOTS;
+const int TimerWheel::LEVELS;
@@ -0,0 +1,93 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_TIMER_WHEEL_HPP
+#define CHIPSIE_TIMER_WHEEL_HPP
+
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+
+typedef uint64_t TimerId;
+
+// Hierarchical timing wheel with 1 ms ticks. Each level has 64 slots, and a
+// timer sits on the lowest level whose slot still tells it apart from the
+// current tick. Timers move down a level when their slot comes up, so
+// adding and cancelling are O(1) and only timers that are due get touched.
+// An occupancy bitmap per level makes finding the next deadline a few bit
+// scans, which lets the loop sleep right up to it.
+class TimerWheel {
+public:
+    typedef std::function<void()> Handler;
+
+    TimerWheel();
+    ~TimerWheel();
+    void Init(uint64_t now_ms);
+    TimerId Add(uint64_t deadline_ms, const Handler &handler);
+    void Cancel(TimerId id);
+    // False if there are no timers
+    bool GetNextDeadline(uint64_t *out_deadline_ms) const;
+    void RunDue(uint64_t now_ms);
+    void Clear();
+
+private:
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    // Enough levels for any 64 bit tick, so nothing ever overflows
+    static const int LEVELS = (64 + SLOT_BITS - 1) / SLOT_BITS;
+
+    struct Link {
+        Link *prev;
+        Link *next;
+    };
+
+    struct Timer : Link {
+        TimerId id;
+        uint64_t deadline;
+        int level; // -1 while in the due list
+        int slot;
+        Handler handler;
+    };
+
+    Link slots[LEVELS][SLOTS];
+    uint64_t occupied[LEVELS];
+    Link due; // Already expired when added
+    uint64_t current_tick;
+    TimerId next_id;
+    std::unordered_map<TimerId, Timer *> lookup;
+
+    void Insert(Timer *timer);
+    void Remove(Timer *timer);
+    bool GetNextWork(uint64_t *out_tick, bool exact) const;
+    void Cascade(int level);
+    void RunList(Link *list);
+
+    static void InitList(Link *list);
+    static void Append(Link *list, Link *item);
+    static void Unlink(Link *item);
+    static void MoveList(Link *from, Link *to);
+    static int FindNextSlot(uint64_t bits, int after);
+};
+
+#endif // CHIPSIE_TIMER_WHEEL_HPP
@@ -0,0 +1,308 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "TlsSession.hpp"
+#include "EventLoop.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef CHIPSIE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif // CHIPSIE_TLS
+
+TlsContext::TlsContext() {
+    ctx = NULL;
+    cached_session = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+TlsContext::~TlsContext() {
+    Shutdown();
+}
+
+#ifdef CHIPSIE_TLS
+
+static double GetCpuMs() {
+    return clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+bool TlsContext::Init(const char *ca_file) {
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL) {
+        printf("ERROR: Failed to create the TLS context\n");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    int rc = 0;
+    if (ca_file != NULL) {
+        rc = SSL_CTX_load_verify_locations(ctx, ca_file, NULL);
+    } else {
+        rc = SSL_CTX_set_default_verify_paths(ctx);
+    }
+    if (rc != 1) {
+        printf("ERROR: Failed to load trusted certificates\n");
+        Shutdown();
+        return false;
+    }
+
+    // Tickets are handed to the callback instead of OpenSSL's own cache.
+    // With TLS 1.3 they only show up after the handshake is done.
+    SSL_CTX_set_app_data(ctx, this);
+    SSL_CTX_set_session_cache_mode(ctx, 
+        SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, OnNewSession);
+    return true;
+}
+
+void TlsContext::Shutdown() {
+    if (cached_session != NULL) {
+        SSL_SESSION_free(cached_session);
+        cached_session = NULL;
+    }
+    if (ctx != NULL) {
+        SSL_CTX_free(ctx);
+        ctx = NULL;
+    }
+}
+
+int TlsContext::OnNewSession(ssl_st *ssl, ssl_session_st *session) {
+    TlsContext *tls_ctx = 
+        (TlsContext *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (tls_ctx->cached_session != NULL) {
+        SSL_SESSION_free(tls_ctx->cached_session);
+    }
+    tls_ctx->cached_session = session;
+    return 1; // We hold on to the reference
+}
+
+TlsSession::TlsSession() {
+    context = NULL;
+    ssl = NULL;
+    net_bio = NULL;
+    handshake_done = false;
+    handshake_start_us = 0;
+    handshake_start_cpu_ms = 0;
+}
+
+TlsSession::~TlsSession() {
+    Reset();
+}
+
+bool TlsSession::Start(TlsContext *tls_ctx, const char *host) {
+    Reset();
+    context = tls_ctx;
+    ssl = SSL_new(context->ctx);
+    if (ssl == NULL) {
+        printf("ERROR: Failed to create a TLS session\n");
+        return false;
+    }
+    BIO *ssl_bio = NULL;
+    if (BIO_new_bio_pair(&ssl_bio, 0, &net_bio, 0) != 1) {
+        printf("ERROR: Failed to create the TLS buffers\n");
+        Reset();
+        return false;
+    }
+    SSL_set_bio(ssl, ssl_bio, ssl_bio);
+    SSL_set_tlsext_host_name(ssl, host);
+    SSL_set1_host(ssl, host);
+    if (context->cached_session != NULL) {
+        SSL_set_session(ssl, context->cached_session);
+    }
+    SSL_set_connect_state(ssl);
+
+    handshake_done = false;
+    handshake_start_us = EventLoop::NowUs();
+    handshake_start_cpu_ms = GetCpuMs();
+    return Handshake(); // Queues the ClientHello
+}
+
+void TlsSession::Reset() {
+    if (ssl != NULL) {
+        // Freeing a session that wasn't shut down marks its tickets as not
+        // resumable. Dropped connections are routine for us, so shut down
+        // quietly rather than lose the fast reconnect.
+        SSL_set_quiet_shutdown(ssl, 1);
+        SSL_shutdown(ssl);
+        SSL_free(ssl); // Also frees the BIO end it was given
+        ssl = NULL;
+    }
+    if (net_bio != NULL) {
+        BIO_free(net_bio);
+        net_bio = NULL;
+    }
+    handshake_done = false;
+}
+
+char *TlsSession::GetCipherSpace(size_t *out_len) {
+    char *space = NULL;
+    int len = BIO_nwrite0(net_bio, &space);
+    *out_len = len > 0 ? (size_t)len : 0;
+    return space;
+}
+
+void TlsSession::CommitCipher(size_t len) {
+    char *space = NULL;
+    BIO_nwrite(net_bio, &space, (int)len);
+}
+
+int TlsSession::Read(char *out, size_t len) {
+    if (!handshake_done) {
+        if (!Handshake()) return -1;
+        if (!handshake_done) return 0;
+    }
+
+    size_t read_len = 0;
+    if (SSL_read_ex(ssl, out, len, &read_len) == 1) return (int)read_len;
+    int err = SSL_get_error(ssl, 0);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    if (err == SSL_ERROR_ZERO_RETURN) {
+        printf("Twitch closed the TLS session\n");
+    } else {
+        printf("WARNING: TLS read failed: %lu\n", ERR_get_error());
+    }
+    return -1;
+}
+
+int TlsSession::Write(const char *data, size_t len) {
+    if (!handshake_done) return 0;
+    size_t written = 0;
+    if (SSL_write_ex(ssl, data, len, &written) == 1) return (int)written;
+    int err = SSL_get_error(ssl, 0);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    printf("WARNING: TLS write failed: %lu\n", ERR_get_error());
+    return -1;
+}
+
+size_t TlsSession::GetPendingCipher(const char **out_data) {
+    char *data = NULL;
+    int len = BIO_nread0(net_bio, &data);
+    *out_data = data;
+    return len > 0 ? (size_t)len : 0;
+}
+
+void TlsSession::ConsumeCipher(size_t len) {
+    char *data = NULL;
+    BIO_nread(net_bio, &data, (int)len);
+}
+
+bool TlsSession::Handshake() {
+    int rc = SSL_do_handshake(ssl);
+    if (rc != 1) {
+        int err = SSL_get_error(ssl, rc);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            return true;
+        }
+        long verify = SSL_get_verify_result(ssl);
+        if (verify != X509_V_OK) {
+            printf("ERROR: Twitch TLS certificate rejected: %s\n", 
+                X509_verify_cert_error_string(verify));
+        } else {
+            printf("WARNING: TLS handshake failed: %lu\n", ERR_get_error());
+        }
+        return false;
+    }
+
+    handshake_done = true;
+    uint64_t took_us = EventLoop::NowUs() - handshake_start_us;
+    double cpu_ms = GetCpuMs() - handshake_start_cpu_ms;
+    bool resumed = SSL_session_reused(ssl) == 1;
+    TlsStats &stats = context->stats;
+    if (resumed) {
+        stats.resumed_count++;
+        stats.resumed_us += took_us;
+        stats.resumed_cpu_ms += cpu_ms;
+    } else {
+        stats.full_count++;
+        stats.full_us += took_us;
+        stats.full_cpu_ms += cpu_ms;
+    }
+    printf("%s TLS handshake (%s) took %.2f ms, %.2f ms CPU\n", 
+        resumed ? "Resumed" : "Full", SSL_get_version(ssl), 
+        took_us / 1000.0, cpu_ms);
+    return true;
+}
+
+#else
+
+bool TlsContext::Init(const char *ca_file) {
+    printf("ERROR: Chipsie was built without TLS support\n");
+    return false;
+}
+
+void TlsContext::Shutdown() {
+}
+
+int TlsContext::OnNewSession(ssl_st *ssl, ssl_session_st *session) {
+    return 0;
+}
+
+TlsSession::TlsSession() {
+    context = NULL;
+    ssl = NULL;
+    net_bio = NULL;
+    handshake_done = false;
+}
+
+TlsSession::~TlsSession() {
+}
+
+bool TlsSession::Start(TlsContext *tls_ctx, const char *host) {
+    return false;
+}
+
+void TlsSession::Reset() {
+}
+
+char *TlsSession::GetCipherSpace(size_t *out_len) {
+    *out_len = 0;
+    return NULL;
+}
+
+void TlsSession::CommitCipher(size_t len) {
+}
+
+int TlsSession::Read(char *out, size_t len) {
+    return -1;
+}
+
+int TlsSession::Write(const char *data, size_t len) {
+    return -1;
+}
+
+size_t TlsSession::GetPendingCipher(const char **out_data) {
+    *out_data = NULL;
+    return 0;
+}
+
+void TlsSession::ConsumeCipher(size_t len) {
+}
+
+bool TlsSession::Handshake() {
+    return false;
+}
+
+#endif // CHIPSIE_TLS
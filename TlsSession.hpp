@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_TLS_SESSION_HPP
+#define CHIPSIE_TLS_SESSION_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// OpenSSL types, so only TlsSession.cpp needs the OpenSSL headers. Builds
+// without CHIPSIE_TLS defined don't link OpenSSL at all and fail TLS setup.
+struct ssl_st;
+struct ssl_ctx_st;
+struct ssl_session_st;
+struct bio_st;
+
+struct TlsStats {
+    uint64_t full_count;
+    uint64_t full_us;
+    double full_cpu_ms;
+    uint64_t resumed_count;
+    uint64_t resumed_us;
+    double resumed_cpu_ms;
+};
+
+// Client settings shared by all connections, plus the most recent session
+// ticket so the next connection can skip the full handshake
+class TlsContext {
+public:
+    TlsContext();
+    ~TlsContext();
+    // ca_file may be NULL to use the system's trusted certificates
+    bool Init(const char *ca_file);
+    void Shutdown();
+    bool IsEnabled() const { return ctx != NULL; }
+    const TlsStats &GetStats() const { return stats; }
+
+private:
+    friend class TlsSession;
+
+    ssl_ctx_st *ctx;
+    ssl_session_st *cached_session;
+    TlsStats stats;
+
+    static int OnNewSession(ssl_st *ssl, ssl_session_st *session);
+};
+
+// TLS on top of an IoEngine socket. OpenSSL talks to a memory BIO pair, so
+// the engine receives ciphertext straight into the BIO's buffer and sends
+// straight out of it, while decrypted bytes land directly in the caller's
+// rx ring.
+class TlsSession {
+public:
+    TlsSession();
+    ~TlsSession();
+    bool Start(TlsContext *tls_ctx, const char *host);
+    void Reset();
+    bool IsActive() const { return ssl != NULL; }
+    bool IsHandshakeDone() const { return handshake_done; }
+
+    // Ciphertext coming in from the socket
+    char *GetCipherSpace(size_t *out_len);
+    void CommitCipher(size_t len);
+    // Advances the handshake and decrypts into out. Returns the number of
+    // plaintext bytes, 0 if more ciphertext is needed, or -1 on failure.
+    int Read(char *out, size_t len);
+
+    // Encrypts data, returns how much was taken (0 until the handshake is
+    // done or while the outgoing buffer is full), or -1 on failure
+    int Write(const char *data, size_t len);
+    // Ciphertext waiting to go out to the socket
+    size_t GetPendingCipher(const char **out_data);
+    void ConsumeCipher(size_t len);
+
+private:
+    TlsContext *context;
+    ssl_st *ssl;
+    bio_st *net_bio; // Our end of the BIO pair
+    bool handshake_done;
+    uint64_t handshake_start_us;
+    double handshake_start_cpu_ms;
+
+    bool Handshake();
+};
+
+#endif // CHIPSIE_TLS_SESSION_HPP
@@ -23,272 +23,765 @@
  */
 
 #include "TwitchConn.hpp"
-#include <thread>
-#include <chrono>
+#include "IrcLine.hpp"
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+static const char * const TX_LANE_NAMES[] = { "control", "mod", "chat" };
+
+TwitchConn::TwitchConn() : rx_msgs(RX_MSG_RING_SIZE) {
+    proc_loop = NULL;
+    stop_requested = false;
+    loop = NULL;
+    engine = NULL;
+    active_link = NULL;
+    standby_link = NULL;
+    resolving_link = NULL;
+    reconnect_timer = 0;
+    reconnect_attempts = 0;
+    tx_rate_timer = 0;
+    cstatus = TWC_NOT_CONNECTED;
+}
 
-static const char * const TWITCH_IRC_ADDR = "irc.chat.twitch.tv";
-static const char * const TWITCH_IRC_PORT = "6667";
+TwitchConnStatus TwitchConn::Init(const AuthData &auth_data, 
+    EventLoop *net_loop, IoEngine *io_engine) {
+    loop = net_loop;
+    engine = io_engine;
+    active_link = NULL;
+    standby_link = NULL;
+    resolving_link = NULL;
+    reconnect_timer = 0;
+    reconnect_attempts = 0;
+    reconnect_rng.seed((uint32_t)EventLoop::NowUs());
+    cstatus = TWC_NOT_CONNECTED;
+    credentials = auth_data;
 
-TwitchConn::TwitchConn() {
+    TlsContext *link_tls = NULL;
+    if (credentials.use_tls) {
+        const char *ca_file = NULL;
+        if (!credentials.ca_file.empty()) ca_file = credentials.ca_file.c_str();
+        if (!tls_ctx.Init(ca_file)) {
+            cstatus = TWC_ERROR;
+            return TWC_ERROR;
+        }
+        link_tls = &tls_ctx;
+    }
+    resolver.Init(credentials.server.c_str(), credentials.port.c_str(), loop);
+    for (int i = 0; i < 2; i++) {
+        links[i].Init(this, &credentials, loop, engine, &resolver, link_tls);
+    }
 
+    rx_order.clear();
+    switch_ids.clear();
+    switch_id_order.clear();
+    rx_backlog.clear();
+    for (int i = 0; i < NUM_TX_LANES; i++) {
+        TxLaneQueue &lane = tx_lanes[i];
+        lane.dropped_count = 0;
+        lane.expired_count = 0;
+        lane.sent_count = 0;
+        lane.max_depth = 0;
+    }
+    rx_dropped_count = 0;
+    tx_window.SetWindow(MSG_WINDOW_MS + RATE_MARGIN_MS);
+    tx_user_window.SetWindow(MSG_WINDOW_MS + RATE_MARGIN_MS);
+    tx_channels.clear();
+    tx_rate_timer = 0;
+    tx_rate_pct = 100;
+    tx_rate_recovery_ms = 0;
+    ratelimit_notice_count = 0;
+    duplicate_notice_count = 0;
+
+    rx_msg_count = 0;
+    tx_line_count = 0;
+    tx_rate_wait_count = 0;
+    migration_count = 0;
+    stats_start_ms = EventLoop::NowMs();
+    stats_start_syscalls = 0;
+    stats_start_cpu = clock();
+    return TWC_NOT_CONNECTED;
+}
+
+bool TwitchConn::Start(EventLoop *processing_loop) {
+    proc_loop = processing_loop;
+    if (!proc_wakeup.Init() || !net_wakeup.Init()) return false;
+    proc_loop->Watch(proc_wakeup.GetHandle(), EV_READ, [this](uint32_t) {
+        proc_wakeup.Clear();
+    });
+    loop->Watch(net_wakeup.GetHandle(), EV_READ, [this](uint32_t) {
+        net_wakeup.Clear();
+    });
+    stop_requested = false;
+    net_thread = std::thread(&TwitchConn::Run, this);
+    return true;
 }
 
-TwitchConnStatus TwitchConn::Init(const AuthData &auth_data) {
-    struct addrinfo hints = { };
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    int rc = getaddrinfo(TWITCH_IRC_ADDR, TWITCH_IRC_PORT, &hints, 
-        &hint_results);
-    if (rc != 0) {
-        printf("ERROR: Failed to get Twitch address info: %d\n",
-            WSAGetLastError());
-        cstatus = TWC_ERROR;
-        return TWC_ERROR;
+void TwitchConn::SetChannelShare(const std::string &name, uint32_t share) {
+    TxChannel &channel = GetTxChannel(name);
+    channel.share = share;
+    for (int i = 0; i < NUM_TX_LANES; i++) {
+        tx_lanes[i].lines.SetShare(name, share);
     }
+}
 
-    sock = INVALID_SOCKET;
-    cstatus = TWC_NOT_CONNECTED;
-    credentials = auth_data;
+TwitchConnStatus TwitchConn::GetConnectionStatus() const {
+    return cstatus;
+}
 
-    memset(line_buffer, 0, LINE_BUFFER_SIZE);
-    line_length = 0;
-    return TWC_NOT_CONNECTED;
+int TwitchConn::GetNumRxMsgs() const {
+    return (int)rx_msgs.GetCount();
+}
+
+std::string_view TwitchConn::GetNextRxMsg(uint64_t *out_arrival_us) {
+    std::string_view record;
+    if (!rx_msgs.Pop(&record)) return std::string_view();
+    RxMsgHeader header;
+    memcpy(&header, record.data(), sizeof(header));
+    *out_arrival_us = header.arrival_us;
+    std::string_view line = record.substr(sizeof(header));
+    // The network thread parks lines it couldn't hand over until told
+    // there is room again
+    if (rx_msgs.TakeBlockedProducer()) net_wakeup.Signal();
+    printf("> %.*s\n", (int)line.size(), line.data());
+    return line;
+}
+
+void TwitchConn::SendMsg(const std::string &msg, TxLane lane, 
+    uint32_t max_age_ms) {
+    if (msg.size() > MAX_TX_LINE_SIZE) {
+        printf("WARNING: Dropped msg that exceeded max length\n");
+        return;
+    }
+    TxLaneQueue &tx_lane = tx_lanes[lane];
+    std::lock_guard<std::mutex> guard(tx_lane.msgs_lock);
+    char *record = tx_lane.msgs.BeginWrite(sizeof(TxMsgHeader) + msg.size());
+    if (record == NULL) {
+        // Twitch isn't taking our data, queueing more would only grow
+        // memory without ever getting sent
+        printf("WARNING: Dropped msg, %s tx backlog is full\n", 
+            TX_LANE_NAMES[lane]);
+        tx_lane.dropped_count++;
+        return;
+    }
+    TxMsgHeader header;
+    header.queued_us = EventLoop::NowUs();
+    header.max_age_ms = max_age_ms;
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), msg.data(), msg.size());
+    if (tx_lane.msgs.CommitWrite()) net_wakeup.Signal();
+}
+
+void TwitchConn::Shutdown() {
+    if (net_thread.joinable()) {
+        stop_requested = true;
+        net_wakeup.Signal();
+        net_thread.join();
+        proc_loop->Unwatch(proc_wakeup.GetHandle());
+        loop->Unwatch(net_wakeup.GetHandle());
+    }
+    if (reconnect_timer != 0) {
+        loop->CancelTimer(reconnect_timer);
+        reconnect_timer = 0;
+    }
+    if (tx_rate_timer != 0) {
+        loop->CancelTimer(tx_rate_timer);
+        tx_rate_timer = 0;
+    }
+    resolver.CancelResolve();
+    resolving_link = NULL;
+    for (int i = 0; i < 2; i++) links[i].Close();
+    active_link = NULL;
+    standby_link = NULL;
+    resolver.Shutdown();
+    if (rx_msg_count % STATS_INTERVAL_MSGS != 0) ReportStats();
+    tls_ctx.Shutdown();
+    proc_wakeup.Shutdown();
+    net_wakeup.Shutdown();
+}
+
+void TwitchConn::Run() {
+    while (!stop_requested) {
+        Update();
+        // Blocks until a socket is ready, a timer is due or the processing
+        // thread has something for us
+        loop->RunOnce();
+        PublishRxMsgs();
+    }
 }
 
 void TwitchConn::Update() {
-    using namespace std;
     if (cstatus == TWC_ERROR) return;
 
-    if (cstatus == TWC_NOT_CONNECTED) {
+    // Reads are driven by the event loop, so all that is left to do here is
+    // (re)connecting and flushing whatever was queued since the last call
+    TakeTxMsgs();
+    if (active_link == NULL && resolving_link == NULL && 
+        reconnect_timer == 0) {
         Connect();
     }
 
-    if (cstatus == TWC_CONNECTED) {
-        Receive();
+    if (active_link != NULL) active_link->Send();
+}
+
+void TwitchConn::TakeTxMsgs() {
+    // Whatever doesn't fit in a lane's queue stays in its ring, so the
+    // processing side finds it full and drops instead
+    for (int i = 0; i < NUM_TX_LANES; i++) {
+        TxLaneQueue &lane = tx_lanes[i];
+        std::string_view record;
+        while (lane.lines.GetSize() < MAX_TX_QUEUE_LINES && 
+            lane.msgs.Pop(&record)) {
+            TxMsgHeader header;
+            memcpy(&header, record.data(), sizeof(header));
+            TxLine tx_line;
+            tx_line.line = std::string(record.substr(sizeof(header)));
+            tx_line.lane = (TxLane)i;
+            if (tx_line.line.compare(0, 9, "PRIVMSG #") == 0) {
+                size_t end = tx_line.line.find(' ', 9);
+                tx_line.channel = tx_line.line.substr(9, end - 9);
+            }
+            tx_line.queued_us = header.queued_us;
+            tx_line.deadline_us = header.queued_us + 
+                header.max_age_ms * 1000ULL;
+            tx_line.end_pos = 0;
+            if (lane.lines.GetSize(tx_line.channel) >= MAX_TX_CHANNEL_LINES) {
+                printf("WARNING: Dropped msg, #%s tx backlog is full\n", 
+                    tx_line.channel.c_str());
+                GetTxChannel(tx_line.channel).dropped_count++;
+                continue;
+            }
+            lane.lines.PushBack(tx_line.channel, std::move(tx_line));
+        }
+        if (lane.lines.GetSize() > lane.max_depth) {
+            lane.max_depth = lane.lines.GetSize();
+        }
     }
+}
 
-    if (cstatus == TWC_CONNECTED) {
-        Send();
+void TwitchConn::PublishRxMsgs() {
+    // The links are always emptied, even while processing is behind. Their
+    // rx rings filling up would stop the reads and with them the PONGs the
+    // keepalive is waiting for.
+    while (!rx_backlog.empty() && PublishRxMsg(rx_backlog.front().line, 
+        rx_backlog.front().arrival_us)) {
+        rx_backlog.pop_front();
+    }
+    // Everything the links hold was read during this turn of the loop
+    uint64_t now_us = EventLoop::NowUs();
+    while (!rx_order.empty()) {
+        TwitchLink *link = rx_order.front();
+        rx_order.pop_front();
+        if (!link->HasRxFrames()) continue;
+
+        std::string_view line = link->PopRxFrame();
+        if (rx_backlog.empty() && PublishRxMsg(line, now_us)) continue;
+        if (rx_backlog.size() >= MAX_RX_BACKLOG_LINES) {
+            rx_backlog.pop_front();
+            rx_dropped_count++;
+        }
+        RxBacklogLine backlog_line;
+        backlog_line.line = std::string(line);
+        backlog_line.arrival_us = now_us;
+        rx_backlog.push_back(std::move(backlog_line));
     }
 }
 
-TwitchConnStatus TwitchConn::GetConnectionStatus() const {
-    return cstatus;
+bool TwitchConn::PublishRxMsg(std::string_view line, uint64_t arrival_us) {
+    char *record = rx_msgs.BeginWrite(sizeof(RxMsgHeader) + line.size());
+    if (record == NULL) return false;
+    RxMsgHeader header;
+    header.arrival_us = arrival_us;
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), line.data(), line.size());
+    if (rx_msgs.CommitWrite()) proc_wakeup.Signal();
+    return true;
 }
 
-int TwitchConn::GetNumRxMsgs() const {
-    // Not thread safe
-    return (int)rx_queue.size();
+void TwitchConn::SetStatus(TwitchConnStatus status) {
+    cstatus = status;
+    proc_wakeup.Signal();
+}
+
+void TwitchConn::Connect() {
+    printf("Attempting twitch connection\n");
+    active_link = GetSpareLink();
+    StartLink(active_link);
 }
 
-std::string TwitchConn::GetNextRxMsg() {
-    // Not thread safe
-    std::string msg = "";
-    if (rx_queue.size() > 0) {
-        msg = rx_queue.front();
-        rx_queue.pop();
+TwitchLink *TwitchConn::GetSpareLink() {
+    // A link that is still flushing is cut short rather than waited on
+    TwitchLink *spare = NULL;
+    for (int i = 0; i < 2; i++) {
+        if (&links[i] == active_link) continue;
+        if (spare == NULL || links[i].GetState() == TwitchLink::LINK_IDLE) {
+            spare = &links[i];
+        }
     }
-    return msg;
+    spare->Close();
+    RequeueUnsent(spare);
+    return spare;
 }
 
-void TwitchConn::SendMsg(const std::string &msg) {
-    // Note thread safe
-    tx_queue.push(msg);
+void TwitchConn::StartLink(TwitchLink *link) {
+    resolving_link = link;
+    resolver.Resolve([this](const std::vector<ResolvedAddr> &addrs) {
+        TwitchLink *link = resolving_link;
+        resolving_link = NULL;
+        if (addrs.empty()) {
+            OnLinkClosed(link);
+        } else {
+            link->Connect(addrs);
+        }
+    });
 }
 
-void TwitchConn::Shutdown() {
-    if (cstatus == TWC_CONNECTED) {
-        closesocket(sock);
-        sock = INVALID_SOCKET;
+void TwitchConn::RequeueUnsent(TwitchLink *link) {
+    std::deque<TxLine> unsent;
+    link->TakeUnsentLines(&unsent);
+    if (unsent.empty()) return;
+    printf("Requeued %d unsent msgs\n", (int)unsent.size());
+    // Back to the front of their lanes, oldest first
+    for (auto it = unsent.rbegin(); it != unsent.rend(); ++it) {
+        std::string channel = it->channel;
+        tx_lanes[it->lane].lines.PushFront(channel, std::move(*it));
     }
 }
 
-void TwitchConn::Connect() {
-    using namespace std;
+TwitchConn::TxChannel &TwitchConn::GetTxChannel(std::string_view name) {
+    std::string key(name);
+    auto it = tx_channels.find(key);
+    if (it != tx_channels.end()) return it->second;
+    TxChannel &channel = tx_channels[key];
+    // The broadcaster is until USERSTATE says otherwise
+    channel.is_mod = name == credentials.nick;
+    channel.slow_ms = 0;
+    channel.share = DrrQueue<TxLine>::DEFAULT_SHARE;
+    channel.sent_count = 0;
+    channel.dropped_count = 0;
+    SetChannelWindow(&channel);
+    return channel;
+}
 
-    printf("Attempting twitch connection\n");
-    addrinfo *addr_info = hint_results;
-    bool connect_ok = false;
-    while (addr_info != NULL && !connect_ok) {
-        sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        if (sock == INVALID_SOCKET) {
-            printf("Failed to create socket\n");
-            cstatus = TWC_ERROR;
-            return;
-        }
+void TwitchConn::SetChannelWindow(TxChannel *channel) {
+    uint32_t window = std::max(CHANNEL_MSG_WINDOW_MS, channel->slow_ms);
+    channel->window.SetWindow(window + RATE_MARGIN_MS);
+}
 
-        int addrlen = (int)addr_info->ai_addrlen;
-        int rc = connect(sock, addr_info->ai_addr, addrlen);
-        addr_info = addr_info->ai_next;
-        if (rc == SOCKET_ERROR) Close();
-        else connect_ok = true;
+uint32_t TwitchConn::GetTxMsgLimit(uint32_t full_limit, uint64_t now_ms) {
+    while (tx_rate_pct < 100 && now_ms >= tx_rate_recovery_ms) {
+        tx_rate_pct = std::min(100u, tx_rate_pct + RATE_RECOVERY_PCT);
+        tx_rate_recovery_ms += MSG_WINDOW_MS;
+        if (tx_rate_pct == 100) printf("Back to the full send rate\n");
     }
-    
-    if (!connect_ok) {
-        printf("WARNING: Failed to connect to Twitch IRC Server\n");
-        printf("\tSocket errno %d\n", WSAGetLastError());
-        return;
+    return std::max(1u, full_limit * tx_rate_pct / 100);
+}
+
+uint64_t TwitchConn::GetTxReadyMs(const TxLine &tx_line, uint64_t now_ms) {
+    if (tx_line.channel.empty()) return now_ms;
+    TxChannel &channel = GetTxChannel(tx_line.channel);
+    uint64_t ready_ms = tx_window.GetNextFreeMs(now_ms, 
+        GetTxMsgLimit(MOD_MSG_LIMIT, now_ms));
+    if (!channel.is_mod) {
+        // A burst in a channel where we are a mod may leave the account
+        // window fuller than USER_MSG_LIMIT, which is why the msgs to the
+        // other channels are counted on their own
+        ready_ms = std::max(ready_ms, tx_user_window.GetNextFreeMs(now_ms, 
+            GetTxMsgLimit(USER_MSG_LIMIT, now_ms)));
+        ready_ms = std::max(ready_ms, channel.window.GetNextFreeMs(now_ms, 1));
     }
-    printf("Connected to Twitch IRC server\n");
+    return ready_ms;
+}
 
-    sprintf_s(tx_buffer, TX_BUFFER_SIZE, "PASS %s\r\n", 
-        credentials.oauth.c_str());
-    int length = (int)strlen(tx_buffer);
-    int rc = send(sock, tx_buffer, length, 0);
-    if (rc != length) {
-        printf("WARNING: Failed to send OAUTH to Twitch: %d\n", 
-            WSAGetLastError());
-        Close();
-        return;
+void TwitchConn::RecordTxSend(const TxLine &tx_line, uint64_t now_ms) {
+    if (tx_line.channel.empty()) return;
+    TxChannel &channel = GetTxChannel(tx_line.channel);
+    tx_window.TrySend(now_ms, GetTxMsgLimit(MOD_MSG_LIMIT, now_ms));
+    if (!channel.is_mod) {
+        tx_user_window.TrySend(now_ms, GetTxMsgLimit(USER_MSG_LIMIT, now_ms));
+        channel.window.TrySend(now_ms, 1);
     }
+}
 
-    this_thread::sleep_for(chrono::milliseconds(100));
+void TwitchConn::WaitForTxWindow(uint64_t ready_ms, uint64_t now_ms) {
+    if (tx_rate_timer != 0) return;
+    tx_rate_wait_count++;
+    tx_rate_timer = loop->AddTimer((uint32_t)(ready_ms - now_ms), [this]() {
+        tx_rate_timer = 0;
+        if (active_link != NULL) active_link->Send();
+    });
+}
 
-    sprintf_s(tx_buffer, TX_BUFFER_SIZE, "NICK %s\r\n", 
-        credentials.nick.c_str());
-    length = (int)strlen(tx_buffer);
-    rc = send(sock, tx_buffer, length, 0);
-    if (rc != length) {
-        printf("WARNING: Failed to send NICK to Twitch: %d\n", 
-            WSAGetLastError());
-        Close();
-        return;
+void TwitchConn::ScheduleReconnect() {
+    if (reconnect_timer != 0) return;
+
+    // Exponential backoff with jitter, so an outage doesn't turn into every
+    // bot hammering Twitch in lockstep. Half of the delay is fixed and the
+    // other half random.
+    uint32_t delay = MAX_RECONNECT_DELAY_MS;
+    if (reconnect_attempts < 16) {
+        uint64_t backoff = (uint64_t)RECONNECT_DELAY_MS << reconnect_attempts;
+        if (backoff < delay) delay = (uint32_t)backoff;
     }
-    printf("Successfully sent credentials to Twitch\n");
+    delay = delay / 2 + (uint32_t)(reconnect_rng() % (delay / 2 + 1));
+    reconnect_attempts++;
+    printf("Reconnecting in %u ms\n", delay);
+
+    reconnect_timer = loop->AddTimer(delay, [this]() {
+        reconnect_timer = 0;
+        if (active_link == NULL && resolving_link == NULL) Connect();
+    });
+}
 
-    this_thread::sleep_for(chrono::milliseconds(100));
+bool TwitchConn::OnRxFrame(TwitchLink *link, std::string_view line) {
+    // Around a switch both links are in the channel. Until the new link
+    // takes over only the old one feeds chat, after that the new one does
+    // and the old one passes on what it reads while it drains, so a line
+    // that only made it onto the old link isn't lost. Chat lines carry an
+    // id, and one that came in on either link is dropped the second time.
+    // Lines without an id, like USERSTATE, only come from the active link,
+    // so those the old link gets after the switch are lost.
+    if (link == standby_link) return false;
+    bool draining = link != active_link;
+    if (draining && link->GetState() != TwitchLink::LINK_DRAINING) {
+        return false;
+    }
+    TwitchLink *other_link = link == &links[0] ? &links[1] : &links[0];
+    if (draining || standby_link != NULL || 
+        other_link->GetState() == TwitchLink::LINK_DRAINING) {
+        if (!IsNewSwitchLine(line, draining)) return false;
+    } else if (!switch_ids.empty()) {
+        switch_ids.clear();
+        switch_id_order.clear();
+    }
 
-    sprintf_s(tx_buffer, "CAP REQ :twitch.tv/commands\r\n");
-    length = (int)strlen(tx_buffer);
-    rc = send(sock, tx_buffer, length, 0);
-    if (rc != length) {
-        printf("WARNING: Failed to send CAP REQ to Twitch: %d\n",
-            WSAGetLastError());
-        Close();
-        return;
+    rx_order.push_back(link);
+    rx_msg_count++;
+    if (rx_msg_count % STATS_INTERVAL_MSGS == 0) ReportStats();
+    return true;
+}
+
+bool TwitchConn::IsNewSwitchLine(std::string_view line, bool draining) {
+    IrcLine irc;
+    std::string_view id;
+    if (!ParseIrcLine(line, &irc) || !GetIrcTag(irc.tags, "id", &id) ||
+        id.empty()) {
+        return !draining;
+    }
+    if (!switch_ids.insert(std::string(id)).second) return false;
+    switch_id_order.push_back(std::string(id));
+    if (switch_id_order.size() > MAX_SWITCH_IDS) {
+        switch_ids.erase(switch_id_order.front());
+        switch_id_order.pop_front();
     }
+    return true;
+}
 
-    this_thread::sleep_for(chrono::milliseconds(100));
+void TwitchConn::OnLinkReset(TwitchLink *link) {
+    rx_order.erase(std::remove(rx_order.begin(), rx_order.end(), link), 
+        rx_order.end());
+}
 
-    sprintf_s(tx_buffer, TX_BUFFER_SIZE, "JOIN #%s\r\n", 
-        credentials.channel.c_str());
-    length = (int)strlen(tx_buffer);
-    rc = send(sock, tx_buffer, length, 0);
-    if (rc != length) {
-        printf("WARNING: Failed to send JOIN to Twitch: %d\n", 
-            WSAGetLastError());
-        Close();
+void TwitchConn::FillTxRing(TwitchLink *link) {
+    // Serialize queued lines into the tx ring, but stop at the high-water
+    // mark so a stalled socket can't make the backlog grow without bound.
+    // Lanes go strictly in order of priority, and a lane with lines that
+    // have to wait for the rate limit holds up everything below it. Inside
+    // a lane, a channel that has to wait doesn't hold up the others. Chat
+    // waits until the login went through.
+    if (link != active_link || link->GetState() != TwitchLink::LINK_READY) {
         return;
     }
-    cstatus = TWC_CONNECTED;
-    line_length = 0;
-    while (rx_queue.size() > 0) rx_queue.pop();
-    while (tx_queue.size() > 0) tx_queue.pop();
+    RingBuffer *tx_ring = link->GetTxRing();
+    uint64_t now_us = EventLoop::NowUs();
+    uint64_t now_ms = now_us / 1000;
+    uint64_t wait_ms = UINT64_MAX; // Earliest a held back line may go
+    DrrQueue<TxLine>::ReadyFunc ready = [&](const TxLine &tx_line) {
+        if (now_us > tx_line.deadline_us) return true; // Dropped right away
+        uint64_t ready_ms = GetTxReadyMs(tx_line, now_ms);
+        if (ready_ms <= now_ms) return true;
+        wait_ms = std::min(wait_ms, ready_ms);
+        return false;
+    };
+    for (int i = 0; i < NUM_TX_LANES; i++) {
+        TxLaneQueue &lane = tx_lanes[i];
+        size_t high_water = i == TX_LANE_CONTROL ? TX_HIGH_WATER : 
+            TX_LOW_LANE_WATER;
+        while (!lane.lines.IsEmpty() && tx_ring->GetSize() < high_water) {
+            TxLine *msg = lane.lines.Next(ready);
+            if (msg == NULL) break;
+            if (now_us > msg->deadline_us) {
+                // A reply to something long gone only confuses chat
+                printf("WARNING: Dropped stale msg: %s\n", msg->line.c_str());
+                lane.expired_count++;
+                lane.lines.Pop();
+                continue;
+            }
+            RecordTxSend(*msg, now_ms);
+            printf("< %s\n", msg->line.c_str());
+            uint64_t wait_us = now_us - msg->queued_us;
+            lane.wait_us.Add(wait_us);
+            lane.sent_count++;
+            TxChannel &channel = GetTxChannel(msg->channel);
+            channel.wait_us.Add(wait_us);
+            channel.sent_count++;
+            tx_line_count++;
+            link->WriteLine(std::move(*msg));
+            lane.lines.Pop();
+        }
+        if (wait_ms != UINT64_MAX) WaitForTxWindow(wait_ms, now_ms);
+        // A lower lane never goes ahead of a higher one with lines left
+        if (!lane.lines.IsEmpty()) return;
+    }
 }
 
-void TwitchConn::Close() {
-    closesocket(sock);
-    sock = INVALID_SOCKET;
-    cstatus = TWC_NOT_CONNECTED;
+bool TwitchConn::HasTxReady() {
+    uint64_t now_ms = EventLoop::NowMs();
+    DrrQueue<TxLine>::ReadyFunc ready = [&](const TxLine &tx_line) {
+        return GetTxReadyMs(tx_line, now_ms) <= now_ms;
+    };
+    for (int i = 0; i < NUM_TX_LANES; i++) {
+        const DrrQueue<TxLine> &lines = tx_lanes[i].lines;
+        if (lines.IsEmpty()) continue;
+        return lines.HasReady(ready);
+    }
+    return false;
 }
 
-void TwitchConn::Receive() {
-    using namespace std;
-
-    FD_SET rx_set;
-    FD_SET err_set;
-    FD_ZERO(&rx_set);
-    FD_ZERO(&err_set);
-    FD_SET(sock, &rx_set);
-    FD_SET(sock, &err_set);
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 50000;
-    int rc = select((int)sock + 1, &rx_set, NULL, &err_set, &tv);
-    if (rc == SOCKET_ERROR) {
-        printf("WARNING: Socket select error %d\n", WSAGetLastError());
-        Close();
+void TwitchConn::OnLinkReady(TwitchLink *link) {
+    reconnect_attempts = 0;
+    SetStatus(TWC_CONNECTED);
+    printf("Joined #%s\n", credentials.channel.c_str());
+
+    if (link == standby_link) {
+        // The new link is in the channel, so the old one only needs to
+        // flush the replies it already took
+        TwitchLink *old_link = active_link;
+        active_link = link;
+        standby_link = NULL;
+        migration_count++;
+        printf("Switched over to the new Twitch connection\n");
+        if (old_link != NULL) old_link->Drain();
+    }
+}
+
+void TwitchConn::OnLinkClosed(TwitchLink *link) {
+    RequeueUnsent(link);
+    if (link == standby_link) {
+        printf("WARNING: Failed to bring up a new Twitch connection, "
+            "staying on the old one\n");
+        standby_link = NULL;
         return;
     }
-    if (rc != 0 && FD_ISSET(sock, &err_set)) {
-        printf("WARNING: Connection failure with Twitch IRC server\n");
-        Close();
+    if (link != active_link) return; // Old link finished draining
+
+    active_link = NULL;
+    SetStatus(TWC_NOT_CONNECTED);
+    if (standby_link != NULL) {
+        // Lost the old link before the switch, carry on with the new one
+        active_link = standby_link;
+        standby_link = NULL;
         return;
     }
-    if (rc != 0 && FD_ISSET(sock, &rx_set)) {
-        rc = recv(sock, rx_buffer, RX_BUFFER_SIZE, 0);
-        if (rc == 0) {
-            printf("Twitch disconnected socket...\n");
-            Close();
-            return;
-        } else if (rc < 0) {
-            printf("WARNING: Socket receive error : %d\n", WSAGetLastError());
-            Close();
-            return;
-        }
+    ScheduleReconnect();
+}
 
-        for (int i = 0; i < rc; i++) {
-            if (rx_buffer[i] == '\r') {
-                if (rx_buffer[i + 1] == '\n') {
-                    if (line_length == 0) continue;
-                    i++;
-                    line_buffer[line_length] = 0;
-                    string line = string(line_buffer);
-                    rx_queue.push(line); // Not thread safe
-                    line_length = 0;
-                    printf("> %s\n", line.c_str());
-                    continue;
-                }
-            }
-            line_buffer[line_length] = rx_buffer[i];
-            line_length++;
-            
-            if (line_length == LINE_BUFFER_SIZE) {
-                printf("WARNING: Twitch violated line buffer length\n");
-                printf("Reconnecting...\n");
-                Close();
-                break;
-            }
-        }
+void TwitchConn::OnLinkRejected(TwitchLink *link) {
+    // Retrying with the same credentials would only get rejected again
+    if (reconnect_timer != 0) {
+        loop->CancelTimer(reconnect_timer);
+        reconnect_timer = 0;
     }
+    resolver.CancelResolve();
+    resolving_link = NULL;
+    for (int i = 0; i < 2; i++) {
+        if (&links[i] != link) links[i].Close();
+    }
+    active_link = NULL;
+    standby_link = NULL;
+    SetStatus(TWC_ERROR);
 }
 
-void TwitchConn::Send() {
-    using namespace std;
-    if (tx_queue.size() < 1) return;
+void TwitchConn::OnReconnectRequested(TwitchLink *link) {
+    if (link != active_link || standby_link != NULL) return;
+    if (resolving_link != NULL) return;
 
-    string line = tx_queue.front();
-    tx_queue.pop();
+    printf("Twitch asked us to reconnect, opening a new connection\n");
+    standby_link = GetSpareLink();
+    StartLink(standby_link);
+}
 
-    if (line.size() >= (TX_BUFFER_SIZE - 3)) {
-        printf("WARNING: Dropped msg that exceeded max length\n");
+void TwitchConn::OnLinkRtt(uint64_t rtt_us) {
+    ping_rtt_us.Add(rtt_us);
+}
+
+void TwitchConn::OnUserState(std::string_view name, bool is_mod) {
+    // Twitch sends one after every msg of ours, so mostly nothing changed.
+    // A bigger budget is picked up by the Send() that follows every read.
+    TxChannel &channel = GetTxChannel(name);
+    if (channel.is_mod == is_mod) return;
+    channel.is_mod = is_mod;
+    printf("%s in #%.*s, sending up to %u msgs per %u s\n", 
+        is_mod ? "Moderator" : "No longer a moderator", (int)name.size(), 
+        name.data(), is_mod ? MOD_MSG_LIMIT : USER_MSG_LIMIT, 
+        MSG_WINDOW_MS / 1000);
+}
+
+void TwitchConn::OnSlowMode(std::string_view name, uint32_t slow_secs) {
+    TxChannel &channel = GetTxChannel(name);
+    if (channel.slow_ms == slow_secs * 1000) return;
+    channel.slow_ms = slow_secs * 1000;
+    SetChannelWindow(&channel);
+    if (slow_secs > 0) {
+        printf("Slow mode in #%.*s, one msg per %u s\n", (int)name.size(), 
+            name.data(), slow_secs);
     } else {
-        printf("< %s\n", line.c_str());
-        sprintf_s(tx_buffer, TX_BUFFER_SIZE, "%s\r\n", line.c_str());
-        int length = (int)strlen(tx_buffer);
-        int bytes_sent = 0;
-        while (bytes_sent < length) {
-            int rc = send(sock, &tx_buffer[bytes_sent], length - bytes_sent, 
-                0);
-            if (rc == 0) {
-                printf("Twitch disconnected socket...\n");
-                Close();
-                return;
-            }
-            if (rc < 0) {
-                printf("WARNING: Failed to send msg to Twitch: %d\n", 
-                    WSAGetLastError());
-                Close();
-                return;
-            }
-            bytes_sent += rc;
+        printf("Slow mode off in #%.*s\n", (int)name.size(), name.data());
+    }
+}
+
+void TwitchConn::OnNotice(std::string_view name, std::string_view msg_id) {
+    if (msg_id == "msg_ratelimit") {
+        ratelimit_notice_count++;
+        uint64_t now_ms = EventLoop::NowMs();
+        tx_rate_pct = std::max(MIN_RATE_PCT, tx_rate_pct / 2);
+        tx_rate_recovery_ms = now_ms + MSG_WINDOW_MS;
+        printf("WARNING: Twitch says we are sending too fast, down to %u%% "
+            "of the rate limit\n", tx_rate_pct);
+    } else if (msg_id == "msg_slowmode" && !name.empty()) {
+        // The ROOMSTATE that should have told us got lost somehow
+        TxChannel &channel = GetTxChannel(name);
+        channel.slow_ms = std::max(channel.slow_ms * 2, DEFAULT_SLOW_MODE_MS);
+        SetChannelWindow(&channel);
+        printf("WARNING: Too fast for slow mode in #%.*s, one msg per %u s\n",
+            (int)name.size(), name.data(), channel.slow_ms / 1000);
+    } else if (msg_id == "msg_duplicate") {
+        duplicate_notice_count++;
+        printf("WARNING: Twitch dropped a msg that repeated the last one\n");
+    }
+}
+
+void TwitchConn::ReportStats() {
+    uint64_t now_ms = EventLoop::NowMs();
+    clock_t now_cpu = clock();
+    uint64_t syscalls = engine->GetStats().syscalls + loop->GetSyscallCount();
+    uint64_t oversize_count = 0;
+    uint64_t dead_link_count = 0;
+    size_t tx_unsent = 0;
+    for (int i = 0; i < 2; i++) {
+        oversize_count += links[i].GetOversizeCount();
+        dead_link_count += links[i].GetDeadLinkCount();
+        tx_unsent += links[i].GetTxRing()->GetSize();
+    }
+
+    uint64_t msgs = rx_msg_count % STATS_INTERVAL_MSGS;
+    if (msgs == 0) msgs = STATS_INTERVAL_MSGS;
+    double secs = (now_ms - stats_start_ms) / 1000.0;
+    double cpu_ms = (now_cpu - stats_start_cpu) * 1000.0 / CLOCKS_PER_SEC;
+    uint64_t call_count = syscalls - stats_start_syscalls;
+    printf("STATS: %s engine, %llu msgs in %.2f s, %llu syscalls "
+        "(%.0f/sec), %.1f ms CPU (%.1f ms per 10k msgs), %llu oversize "
+        "lines dropped, %llu lines backlogged, %llu lines dropped "
+        "behind processing\n", engine->GetName(), (unsigned long long)msgs, 
+        secs, (unsigned long long)call_count, 
+        secs > 0 ? call_count / secs : 0.0, cpu_ms, cpu_ms * 10000.0 / msgs,
+        (unsigned long long)oversize_count, 
+        (unsigned long long)rx_backlog.size(), 
+        (unsigned long long)rx_dropped_count);
+
+    printf("STATS: %llu lines sent (%.0f/sec), %llu bytes unsent, "
+        "%llu waits for the rate limit, %u msgs in the last %u s, "
+        "%llu server moves\n", (unsigned long long)tx_line_count, 
+        secs > 0 ? tx_line_count / secs : 0.0, 
+        (unsigned long long)tx_unsent, 
+        (unsigned long long)tx_rate_wait_count, tx_window.GetSent(now_ms),
+        MSG_WINDOW_MS / 1000, (unsigned long long)migration_count);
+    printf("STATS: sending at %u%% of the rate limit, %llu rate limit "
+        "notices, %llu duplicate msg notices\n", tx_rate_pct,
+        (unsigned long long)ratelimit_notice_count, 
+        (unsigned long long)duplicate_notice_count);
+    for (int i = 0; i < NUM_TX_LANES; i++) {
+        TxLaneQueue &lane = tx_lanes[i];
+        printf("STATS: %s lane, %llu lines sent, depth %llu (max %llu), "
+            "queue wait p50 %.2f ms, p99 %.2f ms, max %.2f ms, %llu lines "
+            "dropped, %llu stale lines dropped\n", TX_LANE_NAMES[i],
+            (unsigned long long)lane.sent_count, 
+            (unsigned long long)lane.lines.GetSize(), 
+            (unsigned long long)lane.max_depth,
+            lane.wait_us.GetPercentile(50) / 1000.0, 
+            lane.wait_us.GetPercentile(99) / 1000.0, 
+            lane.wait_us.GetMax() / 1000.0,
+            (unsigned long long)lane.dropped_count.load(),
+            (unsigned long long)lane.expired_count);
+        lane.sent_count = 0;
+        lane.max_depth = lane.lines.GetSize();
+        lane.wait_us.Reset();
+    }
+    for (auto &it : tx_channels) {
+        // Lines that aren't PRIVMSGs go through the channel with no name
+        TxChannel &channel = it.second;
+        const char *prefix = it.first.empty() ? "server" : "#";
+        size_t queued = 0;
+        for (int i = 0; i < NUM_TX_LANES; i++) {
+            queued += tx_lanes[i].lines.GetSize(it.first);
         }
+        if (channel.sent_count == 0 && queued == 0) continue;
+        printf("STATS: %s%s tx, share %u, %llu lines sent, %llu queued, "
+            "queue wait p50 %.2f ms, p99 %.2f ms, %llu lines dropped\n",
+            prefix, it.first.c_str(), channel.share, 
+            (unsigned long long)channel.sent_count, 
+            (unsigned long long)queued, 
+            channel.wait_us.GetPercentile(50) / 1000.0, 
+            channel.wait_us.GetPercentile(99) / 1000.0, 
+            (unsigned long long)channel.dropped_count);
+        channel.sent_count = 0;
+        channel.wait_us.Reset();
     }
+
+    printf("STATS: %llu pings, RTT p50 %.2f ms, p99 %.2f ms, max %.2f ms, "
+        "%llu dead links detected\n", 
+        (unsigned long long)ping_rtt_us.GetCount(), 
+        ping_rtt_us.GetPercentile(50) / 1000.0, 
+        ping_rtt_us.GetPercentile(99) / 1000.0, 
+        ping_rtt_us.GetMax() / 1000.0, (unsigned long long)dead_link_count);
+
+    if (tls_ctx.IsEnabled()) {
+        const TlsStats &tls = tls_ctx.GetStats();
+        uint64_t full = tls.full_count > 0 ? tls.full_count : 1;
+        uint64_t resumed = tls.resumed_count > 0 ? tls.resumed_count : 1;
+        printf("STATS: TLS handshakes, %llu full (avg %.2f ms, %.2f ms "
+            "CPU), %llu resumed (avg %.2f ms, %.2f ms CPU)\n",
+            (unsigned long long)tls.full_count, tls.full_us / 1000.0 / full,
+            tls.full_cpu_ms / full, (unsigned long long)tls.resumed_count,
+            tls.resumed_us / 1000.0 / resumed, tls.resumed_cpu_ms / resumed);
+    }
+
+    stats_start_ms = now_ms;
+    stats_start_cpu = now_cpu;
+    stats_start_syscalls = syscalls;
+    tx_line_count = 0;
+    tx_rate_wait_count = 0;
 }
 
 // Static initializers
-const int TwitchConn::RX_BUFFER_SIZE;
-const int TwitchConn::TX_BUFFER_SIZE;
-const int TwitchConn::LINE_BUFFER_SIZE;
+const uint32_t TwitchConn::DEFAULT_TX_MAX_AGE_MS;
+const uint64_t TwitchConn::STATS_INTERVAL_MSGS;
+const uint32_t TwitchConn::RECONNECT_DELAY_MS;
+const uint32_t TwitchConn::MAX_RECONNECT_DELAY_MS;
+const size_t TwitchConn::MAX_TX_LINE_SIZE;
+const size_t TwitchConn::TX_HIGH_WATER;
+const size_t TwitchConn::TX_LOW_LANE_WATER;
+const size_t TwitchConn::MAX_TX_QUEUE_LINES;
+const size_t TwitchConn::MAX_TX_CHANNEL_LINES;
+const size_t TwitchConn::RX_MSG_RING_SIZE;
+const size_t TwitchConn::TX_MSG_RING_SIZE;
+const size_t TwitchConn::MAX_RX_BACKLOG_LINES;
+const size_t TwitchConn::MAX_SWITCH_IDS;
+const uint32_t TwitchConn::USER_MSG_LIMIT;
+const uint32_t TwitchConn::MOD_MSG_LIMIT;
+const uint32_t TwitchConn::MSG_WINDOW_MS;
+const uint32_t TwitchConn::CHANNEL_MSG_WINDOW_MS;
+const uint32_t TwitchConn::RATE_MARGIN_MS;
+const uint32_t TwitchConn::MIN_RATE_PCT;
+const uint32_t TwitchConn::RATE_RECOVERY_PCT;
+const uint32_t TwitchConn::DEFAULT_SLOW_MODE_MS;
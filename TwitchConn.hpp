@@ -25,13 +25,29 @@
 #ifndef CHIPSIE_TWITCH_CONNECTION_HPP
 #define CHIPSIE_TWITCH_CONNECTION_HPP
 
-#ifdef _WIN32
-#include <ws2tcpip.h>
-#include <winsock2.h>
-#endif // _WIN32
-
+#include "NetPlatform.hpp"
+#include "EventLoop.hpp"
+#include "IoEngine.hpp"
+#include "DrrQueue.hpp"
+#include "Histogram.hpp"
+#include "Resolver.hpp"
+#include "TwitchLink.hpp"
+#include "TlsSession.hpp"
+#include "SpscRing.hpp"
+#include "SendWindow.hpp"
+#include "Wakeup.hpp"
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <string>
+#include <string_view>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
 
 enum TwitchConnStatus {
     TWC_ERROR,
@@ -44,40 +60,210 @@ struct AuthData {
     std::string client_id;
     std::string nick;
     std::string channel;
+    std::string server;
+    std::string port;
+    bool use_tls;
+    std::string ca_file; // Empty to trust the system's certificates
 };
 
+// The sockets, keepalive and reconnects all live on a network thread of
+// their own, so slow chat processing can never hold up reading from Twitch
+// or answering its PINGs. Lines are handed across in both directions
+// through SPSC rings. SendMsg() may be called from any thread, the other
+// public methods are meant for the one thread that takes the rx msgs.
 class TwitchConn {
 public:
+    static const uint32_t DEFAULT_TX_MAX_AGE_MS = 30000;
+
     TwitchConn();
-    TwitchConnStatus Init(const AuthData &auth_data);
-    void Update();
+    // net_loop and io_engine belong to the network thread from Start() on
+    TwitchConnStatus Init(const AuthData &auth_data, EventLoop *net_loop,
+        IoEngine *io_engine);
+    // Spawns the network thread. proc_loop is woken whenever there are new
+    // rx msgs or the status changed.
+    bool Start(EventLoop *proc_loop);
+    // Weight of the channel when several have lines waiting, 1 by default.
+    // Call before Start().
+    void SetChannelShare(const std::string &channel, uint32_t share);
     TwitchConnStatus GetConnectionStatus() const;
     int GetNumRxMsgs() const;
-    std::string GetNextRxMsg();
-    void SendMsg(const std::string &msg);
+    // The returned view stays valid until the next call. out_arrival_us is
+    // when the network thread read the line.
+    std::string_view GetNextRxMsg(uint64_t *out_arrival_us);
+    // Messages still waiting for a connection after max_age_ms are dropped
+    void SendMsg(const std::string &msg, TxLane lane = TX_LANE_CHAT,
+        uint32_t max_age_ms = DEFAULT_TX_MAX_AGE_MS);
     void Shutdown();
 
 private:
-    static const int TX_BUFFER_SIZE = 2048;
-    static const int RX_BUFFER_SIZE = 2048;
-    static const int LINE_BUFFER_SIZE = 2048;
-    
-    char tx_buffer[TX_BUFFER_SIZE];
-    char rx_buffer[RX_BUFFER_SIZE];
-    char line_buffer[LINE_BUFFER_SIZE];
-    int line_length;
-
-    SOCKET sock;
-    struct addrinfo *hint_results;
-    TwitchConnStatus cstatus;
+    static const size_t MAX_TX_LINE_SIZE = 2045;
+    static const size_t TX_HIGH_WATER = 65536;
+    // Only the control lane fills the tx ring up to the high-water mark.
+    // The others stop here, so what the link writes itself, like PONGs,
+    // never queues behind more than a line or two of them.
+    static const size_t TX_LOW_LANE_WATER = 2048;
+    static const size_t MAX_TX_QUEUE_LINES = 1024;
+    // A channel with more than this waiting in a lane has any more of its
+    // lines dropped, rather than crowding the other channels out
+    static const size_t MAX_TX_CHANNEL_LINES = 256;
+    static const uint32_t RECONNECT_DELAY_MS = 1000;
+    static const uint32_t MAX_RECONNECT_DELAY_MS = 60000;
+    static const uint64_t STATS_INTERVAL_MSGS = 10000;
+    static const size_t RX_MSG_RING_SIZE = 1 << 20;
+    static const size_t TX_MSG_RING_SIZE = 1 << 18;
+    static const size_t MAX_RX_BACKLOG_LINES = 65536;
+    // Chat line ids remembered while two links are in the channel
+    static const size_t MAX_SWITCH_IDS = 4096;
+    // Twitch's chat limits. Every PRIVMSG counts against the account, up
+    // to MOD_MSG_LIMIT in a window. Of those, the ones to channels where
+    // we aren't a moderator or the broadcaster may only be USER_MSG_LIMIT,
+    // and each such channel also only gets one msg per
+    // CHANNEL_MSG_WINDOW_MS, or per slow mode interval. The windows carry
+    // a margin, since Twitch times the msgs on arrival and not as we send.
+    static const uint32_t USER_MSG_LIMIT = 20;
+    static const uint32_t MOD_MSG_LIMIT = 100;
+    static const uint32_t MSG_WINDOW_MS = 30000;
+    static const uint32_t CHANNEL_MSG_WINDOW_MS = 1000;
+    static const uint32_t RATE_MARGIN_MS = 500;
+    // Should Twitch still say we are too fast, the limits are halved down
+    // to MIN_RATE_PCT, then eased back up by RATE_RECOVERY_PCT every
+    // window that passes without another complaint
+    static const uint32_t MIN_RATE_PCT = 10;
+    static const uint32_t RATE_RECOVERY_PCT = 10;
+    // Assumed when Twitch says slow mode is on but we missed by how much
+    static const uint32_t DEFAULT_SLOW_MODE_MS = 30000;
+
+    // Prefix of every record in a lane's msgs ring
+    struct TxMsgHeader {
+        uint64_t queued_us;
+        uint32_t max_age_ms;
+    };
+
+    // Prefix of every record in rx_msgs
+    struct RxMsgHeader {
+        uint64_t arrival_us;
+    };
+
+    struct RxBacklogLine {
+        std::string line;
+        uint64_t arrival_us;
+    };
+
+    // Each lane has a ring of its own, so a full chat lane can't keep the
+    // others from getting their lines across. In the lane, the channels
+    // take turns by deficit round robin.
+    struct TxLaneQueue {
+        SpscRing msgs;
+        std::mutex msgs_lock; // Senders take turns as its producer
+        DrrQueue<TxLine> lines; // By channel, survive reconnects
+        std::atomic<uint64_t> dropped_count;
+        uint64_t expired_count;
+        uint64_t sent_count;
+        size_t max_depth;
+        Histogram wait_us;
+
+        TxLaneQueue() : msgs(TX_MSG_RING_SIZE) {}
+    };
+
+    struct TxChannel {
+        SendWindow window; // Only counts while we aren't a mod
+        bool is_mod; // Or the broadcaster
+        uint32_t slow_ms; // 0 when slow mode is off
+        uint32_t share;
+        uint64_t sent_count;
+        uint64_t dropped_count; // Over MAX_TX_CHANNEL_LINES
+        Histogram wait_us;
+    };
+
+    // Links report back through the private callbacks below
+    friend class TwitchLink;
+
+    // Handoff between the threads. Rx msgs that don't fit wait in
+    // rx_backlog instead of in the links, which have to keep reading.
+    SpscRing rx_msgs;
+    Wakeup proc_wakeup; // Rx msgs or a status change for the processing side
+    Wakeup net_wakeup; // Tx msgs, free rx space or time to stop
+    std::deque<RxBacklogLine> rx_backlog;
+    EventLoop *proc_loop;
+    std::thread net_thread;
+    std::atomic<bool> stop_requested;
+
+    // Whatever a dead link didn't send is put back into its lane
+    TxLaneQueue tx_lanes[NUM_TX_LANES];
+    SendWindow tx_window; // The account's msgs over all channels
+    SendWindow tx_user_window; // Those to channels where we aren't a mod
+    std::unordered_map<std::string, TxChannel> tx_channels;
+    TimerId tx_rate_timer; // Sends again once the rate limit allows
+    uint32_t tx_rate_pct; // Share of the limits we allow ourselves
+    uint64_t tx_rate_recovery_ms; // Next step back up
+    uint64_t ratelimit_notice_count;
+    uint64_t duplicate_notice_count;
+    uint64_t rx_dropped_count;
+
+    // Twitch asks us to move before server maintenance, so there may be a
+    // second link coming up while the old one is still in use
+    TwitchLink links[2];
+    TwitchLink *active_link; // Link chat is received from and sent through
+    TwitchLink *standby_link; // Replacement for the active link
+    TwitchLink *resolving_link; // Waiting on DNS before it can connect
+    std::deque<TwitchLink *> rx_order; // Link each queued rx line is in
+    std::unordered_set<std::string> switch_ids; // Passed on during a switch
+    std::deque<std::string> switch_id_order; // Oldest first
+
+    EventLoop *loop;
+    IoEngine *engine;
+    Resolver resolver;
+    TlsContext tls_ctx;
+    TimerId reconnect_timer;
+    uint32_t reconnect_attempts; // Failures since a link was last ready
+    std::minstd_rand reconnect_rng;
+    std::atomic<TwitchConnStatus> cstatus;
     AuthData credentials;
-    std::queue<std::string> rx_queue;
-    std::queue<std::string> tx_queue;
 
+    uint64_t rx_msg_count;
+    uint64_t tx_line_count;
+    uint64_t tx_rate_wait_count;
+    uint64_t migration_count;
+    Histogram ping_rtt_us;
+    uint64_t stats_start_ms;
+    uint64_t stats_start_syscalls;
+    clock_t stats_start_cpu;
+
+    // Network thread
+    void Run();
+    void Update();
+    void TakeTxMsgs();
+    void PublishRxMsgs();
+    bool IsNewSwitchLine(std::string_view line, bool draining);
+    bool PublishRxMsg(std::string_view line, uint64_t arrival_us);
+    void SetStatus(TwitchConnStatus status);
     void Connect();
-    void Close();
-    void Receive();
-    void Send();
+    TwitchLink *GetSpareLink();
+    void StartLink(TwitchLink *link);
+    void RequeueUnsent(TwitchLink *link);
+    TxChannel &GetTxChannel(std::string_view name);
+    void SetChannelWindow(TxChannel *channel);
+    uint32_t GetTxMsgLimit(uint32_t full_limit, uint64_t now_ms);
+    uint64_t GetTxReadyMs(const TxLine &tx_line, uint64_t now_ms);
+    void RecordTxSend(const TxLine &tx_line, uint64_t now_ms);
+    void WaitForTxWindow(uint64_t ready_ms, uint64_t now_ms);
+    void ScheduleReconnect();
+    void ReportStats();
+
+    // Called by the links
+    bool OnRxFrame(TwitchLink *link, std::string_view line);
+    void OnLinkReset(TwitchLink *link);
+    void FillTxRing(TwitchLink *link);
+    // Whether a queued line may go out right now
+    bool HasTxReady();
+    void OnLinkReady(TwitchLink *link);
+    void OnLinkClosed(TwitchLink *link);
+    void OnLinkRejected(TwitchLink *link);
+    void OnReconnectRequested(TwitchLink *link);
+    void OnLinkRtt(uint64_t rtt_us);
+    void OnUserState(std::string_view channel, bool is_mod);
+    void OnSlowMode(std::string_view channel, uint32_t slow_secs);
+    void OnNotice(std::string_view channel, std::string_view msg_id);
 };
 
 #endif // SAT_TWITCH_CONNECTION_HPP
\ No newline at end of file
@@ -0,0 +1,717 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "TwitchLink.hpp"
+#include "TwitchConn.hpp"
+#include "IrcLine.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+TwitchLink::TwitchLink() {
+    owner = NULL;
+    credentials = NULL;
+    loop = NULL;
+    engine = NULL;
+    resolver = NULL;
+    tls_ctx = NULL;
+    sock = NET_INVALID_SOCKET;
+    link_state = LINK_IDLE;
+    link_timer = 0;
+    ping_timer = 0;
+    ping_seq = 0;
+    ping_sent_us = 0;
+    ping_rx_pos = 0;
+    ping_extensions = 0;
+    dead_link_count = 0;
+    got_welcome = false;
+    got_cap_ack = false;
+    got_join = false;
+    login_end_pos = 0;
+    connect_index = 0;
+    attempt_timer = 0;
+    connect_start_us = 0;
+    connect_err = 0;
+    rx_line_start = 0;
+    rx_scan_pos = 0;
+    rx_discarding = false;
+    rx_oversize_count = 0;
+}
+
+void TwitchLink::Init(TwitchConn *owner_conn, const AuthData *auth_data, 
+    EventLoop *event_loop, IoEngine *io_engine, Resolver *dns, 
+    TlsContext *tls_context) {
+    owner = owner_conn;
+    tls_ctx = tls_context;
+    credentials = auth_data;
+    loop = event_loop;
+    engine = io_engine;
+    resolver = dns;
+    ResetRx();
+    tx_ring.Clear();
+}
+
+void TwitchLink::Connect(const std::vector<ResolvedAddr> &addrs) {
+    // Keep the resolver's order within each family, but alternate between
+    // families so a broken IPv6 path only ever costs one attempt delay
+    connect_addrs.clear();
+    std::vector<ResolvedAddr> other_family;
+    int first_family = addrs.empty() ? AF_UNSPEC : addrs[0].family;
+    for (size_t i = 0; i < addrs.size(); i++) {
+        if (addrs[i].family == first_family) {
+            connect_addrs.push_back(addrs[i]);
+        } else {
+            other_family.push_back(addrs[i]);
+        }
+    }
+    for (size_t i = 0; i < other_family.size(); i++) {
+        size_t pos = 2 * i + 1;
+        if (pos > connect_addrs.size()) pos = connect_addrs.size();
+        connect_addrs.insert(connect_addrs.begin() + pos, other_family[i]);
+    }
+
+    connect_index = 0;
+    connect_err = 0;
+    connect_start_us = EventLoop::NowUs();
+    link_state = LINK_CONNECTING;
+    link_timer = loop->AddTimer(CONNECT_TIMEOUT_MS, [this]() {
+        link_timer = 0;
+        printf("WARNING: Timed out connecting to Twitch IRC server\n");
+        Fail();
+    });
+    StartAttempt();
+}
+
+void TwitchLink::Drain() {
+    link_state = LINK_DRAINING;
+    if (ping_timer != 0) {
+        loop->CancelTimer(ping_timer);
+        ping_timer = 0;
+    }
+    link_timer = loop->AddTimer(DRAIN_TIMEOUT_MS, [this]() {
+        link_timer = 0;
+        printf("WARNING: Gave up flushing the old Twitch connection\n");
+        Fail();
+    });
+    // Closes the link right away if nothing is left to flush
+    Send();
+}
+
+void TwitchLink::Close() {
+    if (link_timer != 0) {
+        loop->CancelTimer(link_timer);
+        link_timer = 0;
+    }
+    if (ping_timer != 0) {
+        loop->CancelTimer(ping_timer);
+        ping_timer = 0;
+    }
+    if (link_state == LINK_CONNECTING) {
+        CancelAttempts();
+    } else if (link_state != LINK_IDLE) {
+        engine->Detach(sock);
+    }
+    tls.Reset();
+    if (sock != NET_INVALID_SOCKET) {
+        NetCloseSocket(sock);
+        sock = NET_INVALID_SOCKET;
+    }
+    link_state = LINK_IDLE;
+}
+
+void TwitchLink::Send() {
+    if (link_state != LINK_REGISTERING && link_state != LINK_READY && 
+        link_state != LINK_DRAINING) {
+        return;
+    }
+
+    for (;;) {
+        owner->FillTxRing(this);
+
+        IoVec vecs[2];
+        int count = 0;
+        size_t pending = 0;
+        if (tls.IsActive()) {
+            // Encrypt as much as the TLS buffer takes, then send that
+            if (!EncryptTxRing()) {
+                Fail();
+                return;
+            }
+            vecs[0].len = tls.GetPendingCipher(&vecs[0].data);
+            count = 1;
+            pending = vecs[0].len;
+        } else {
+            const char *data[2];
+            size_t len[2];
+            count = tx_ring.GetReadSegments(data, len);
+            for (int i = 0; i < count; i++) {
+                vecs[i].data = data[i];
+                vecs[i].len = len[i];
+            }
+            pending = tx_ring.GetSize();
+        }
+        if (pending == 0) break;
+
+        int rc = engine->Send(sock, vecs, count);
+        if (rc < 0) {
+            printf("WARNING: Failed to send msg to Twitch: %d\n", 
+                NetGetLastError());
+            Fail();
+            return;
+        }
+
+        // Whatever the socket didn't take stays buffered until the engine
+        // reports the socket as writable again
+        if (tls.IsActive()) {
+            tls.ConsumeCipher((size_t)rc);
+        } else {
+            tx_ring.ConsumeTo(tx_ring.GetReadPos() + rc);
+            ReleaseSentLines();
+        }
+        if ((size_t)rc < pending) break;
+        if (tx_ring.GetSize() == 0 && !owner->HasTxReady()) break;
+        if (link_state != LINK_READY) break;
+    }
+
+    const char *cipher = NULL;
+    size_t cipher_len = tls.IsActive() ? tls.GetPendingCipher(&cipher) : 0;
+    if (login_end_pos != 0 && tx_ring.GetReadPos() >= login_end_pos &&
+        cipher_len == 0) {
+        printf("Sent credentials to Twitch\n");
+        login_end_pos = 0;
+    }
+    // The engine may still hold bytes it took, and those would be lost if
+    // the socket closed now. It calls OnWritable once they are written.
+    if (link_state == LINK_DRAINING && tx_ring.GetSize() == 0 && 
+        cipher_len == 0 && engine->GetPendingSend(sock) == 0) {
+        printf("Closed the old Twitch connection\n");
+        Close();
+        owner->OnLinkClosed(this);
+        return;
+    }
+
+    // TLS can't take plaintext until the handshake is done. Until then only
+    // pending ciphertext is worth waking up for, or a level-triggered poll
+    // would report the socket writable over and over.
+    bool more = tx_ring.GetSize() > 0;
+    if (tls.IsActive()) {
+        more = cipher_len > 0 || (tls.IsHandshakeDone() && more);
+    }
+    if (link_state == LINK_READY && owner->HasTxReady()) more = true;
+    engine->SetWantWrite(sock, more);
+}
+
+bool TwitchLink::EncryptTxRing() {
+    while (tx_ring.GetSize() > 0) {
+        const char *data[2];
+        size_t len[2];
+        tx_ring.GetReadSegments(data, len);
+        int rc = tls.Write(data[0], len[0]);
+        if (rc < 0) return false;
+        if (rc == 0) break;
+        tx_ring.ConsumeTo(tx_ring.GetReadPos() + rc);
+    }
+    // Once encrypted a line can't be pulled back out of the TLS stream, so
+    // it counts as sent from here on
+    ReleaseSentLines();
+    return true;
+}
+
+void TwitchLink::ReleaseSentLines() {
+    while (!tx_lines.empty() && 
+        tx_lines.front().end_pos <= tx_ring.GetReadPos()) {
+        tx_lines.pop_front();
+    }
+}
+
+void TwitchLink::WriteLine(TxLine &&tx_line) {
+    tx_ring.Write(tx_line.line.data(), tx_line.line.size());
+    tx_ring.Write("\r\n", 2);
+    tx_line.end_pos = tx_ring.GetWritePos();
+    tx_lines.push_back(std::move(tx_line));
+}
+
+void TwitchLink::TakeUnsentLines(std::deque<TxLine> *out) {
+    // A line the socket only took part of went nowhere useful, so it is
+    // sent again in full. Bytes the kernel accepted but never delivered
+    // can't be told apart from delivered ones and are lost.
+    uint64_t sent_pos = tx_ring.GetReadPos();
+    while (!tx_lines.empty()) {
+        if (tx_lines.front().end_pos > sent_pos) {
+            out->push_back(std::move(tx_lines.front()));
+        }
+        tx_lines.pop_front();
+    }
+}
+
+std::string_view TwitchLink::PopRxFrame() {
+    if (rx_frames.empty()) return std::string_view();
+
+    // Frames point straight into the ring, so handing out the next one is
+    // also what releases the previous one
+    RxFrame frame = rx_frames.front();
+    rx_frames.pop_front();
+    rx_ring.ConsumeTo(frame.pos);
+    return rx_ring.View(frame.pos, frame.len, &rx_wrap_line);
+}
+
+char *TwitchLink::GetRecvSpace(size_t *out_len) {
+    if (tls.IsActive()) return tls.GetCipherSpace(out_len);
+    return GetPlainSpace(out_len);
+}
+
+void TwitchLink::OnRecv(size_t len) {
+    if (!tls.IsActive()) {
+        OnPlainRecv(len);
+        if (link_state != LINK_IDLE) Send(); // PONGs, if there were PINGs
+        return;
+    }
+
+    // Decrypt straight into the rx ring, the frames then point into the
+    // plaintext just like without TLS
+    tls.CommitCipher(len);
+    for (;;) {
+        size_t space = 0;
+        char *plain = GetPlainSpace(&space);
+        int rc = tls.Read(plain, space);
+        if (rc < 0) {
+            Fail();
+            return;
+        }
+        if (rc == 0) break;
+        OnPlainRecv((size_t)rc);
+        if (link_state == LINK_IDLE) return;
+    }
+
+    // Handshake replies and the login that waited on the handshake
+    Send();
+}
+
+char *TwitchLink::GetPlainSpace(size_t *out_len) {
+    // Frames handed out before the loop started running are free to reuse
+    uint64_t keep_pos = rx_line_start;
+    if (!rx_frames.empty()) keep_pos = rx_frames.front().pos;
+    rx_ring.ConsumeTo(keep_pos);
+    return rx_ring.GetWriteSpace(RX_MIN_SPACE, out_len);
+}
+
+void TwitchLink::OnPlainRecv(size_t len) {
+    rx_ring.CommitWrite(len);
+
+    uint64_t lf_pos = 0;
+    while (rx_ring.Find('\n', rx_scan_pos, &lf_pos)) {
+        uint64_t end = lf_pos;
+        if (end > rx_line_start && rx_ring.At(end - 1) == '\r') end--;
+        if (rx_discarding) {
+            rx_discarding = false;
+        } else if (end - rx_line_start > MAX_LINE_SIZE) {
+            DropOversizeLine();
+        } else if (end > rx_line_start) {
+            OnFrame(rx_line_start, (size_t)(end - rx_line_start));
+            if (link_state == LINK_IDLE) return; // Closed by the frame
+        }
+        rx_line_start = lf_pos + 1;
+        rx_scan_pos = lf_pos + 1;
+    }
+    rx_scan_pos = rx_ring.GetWritePos();
+
+    // Rather than reconnecting over a runaway line, throw it away and pick
+    // back up at the next line ending
+    if (!rx_discarding && rx_scan_pos - rx_line_start > MAX_LINE_SIZE) {
+        DropOversizeLine();
+        rx_discarding = true;
+    }
+    if (rx_discarding) rx_line_start = rx_scan_pos;
+}
+
+void TwitchLink::OnClosed(int err) {
+    if (err == 0) {
+        printf("Twitch disconnected socket...\n");
+    } else {
+        printf("WARNING: Connection failure with Twitch IRC server: %d\n", 
+            err);
+    }
+    Fail();
+}
+
+void TwitchLink::OnWritable() {
+    Send();
+}
+
+void TwitchLink::StartAttempt() {
+    if (attempt_timer != 0) {
+        loop->CancelTimer(attempt_timer);
+        attempt_timer = 0;
+    }
+
+    while (connect_index < connect_addrs.size()) {
+        size_t index = connect_index++;
+        const ResolvedAddr &addr = connect_addrs[index];
+        NetSocket attempt_sock = socket(addr.family, SOCK_STREAM, 
+            IPPROTO_TCP);
+        if (attempt_sock == NET_INVALID_SOCKET) {
+            // E.g. no IPv6 on this host, move on to the other family
+            connect_err = NetGetLastError();
+            resolver->MarkFailed(addr);
+            continue;
+        }
+
+        int err = 0;
+        if (NetSetNonBlocking(attempt_sock)) {
+            int rc = connect(attempt_sock, 
+                (const struct sockaddr *)&addr.addr, addr.addr_len);
+            if (rc != 0) err = NetGetLastError();
+        } else {
+            err = NetGetLastError();
+        }
+        if (err != 0 && !NetConnectPending(err)) {
+            connect_err = err;
+            NetCloseSocket(attempt_sock);
+            resolver->MarkFailed(addr);
+            continue;
+        }
+
+        // Even a connect that finished right away is reported through
+        // writability, which keeps a single path for picking the winner
+        ConnectAttempt attempt = { attempt_sock, index };
+        attempts.push_back(attempt);
+        loop->Watch(attempt_sock, EV_WRITE, [this, attempt_sock](uint32_t ev) {
+            OnAttemptEvent(attempt_sock, ev);
+        });
+        if (connect_index < connect_addrs.size()) {
+            attempt_timer = loop->AddTimer(ATTEMPT_DELAY_MS, [this]() {
+                attempt_timer = 0;
+                StartAttempt();
+            });
+        }
+        return;
+    }
+
+    if (attempts.empty()) {
+        printf("WARNING: Failed to connect to Twitch IRC Server\n");
+        printf("\tSocket errno %d\n", connect_err);
+        // Twitch may have moved, look the name up again before retrying
+        resolver->Invalidate();
+        Close();
+        owner->OnLinkClosed(this);
+    }
+}
+
+void TwitchLink::OnAttemptEvent(NetSocket attempt_sock, uint32_t events) {
+    size_t i = 0;
+    while (i < attempts.size() && attempts[i].sock != attempt_sock) i++;
+    if (i == attempts.size()) return;
+    ConnectAttempt attempt = attempts[i];
+    attempts.erase(attempts.begin() + i);
+    loop->Unwatch(attempt_sock);
+
+    int err = NetGetSocketError(attempt_sock);
+    if (err == 0 && (events & EV_ERROR)) err = -1;
+    if (err != 0) {
+        // Don't wait out the delay, the next address gets its turn now
+        connect_err = err;
+        NetCloseSocket(attempt_sock);
+        resolver->MarkFailed(connect_addrs[attempt.addr_index]);
+        StartAttempt();
+        return;
+    }
+
+    // Got a winner, the attempts still racing are not needed anymore
+    CancelAttempts();
+    if (link_timer != 0) {
+        loop->CancelTimer(link_timer);
+        link_timer = 0;
+    }
+    sock = attempt_sock;
+    const ResolvedAddr &addr = connect_addrs[attempt.addr_index];
+    resolver->MarkConnected(addr);
+    printf("Connected to Twitch IRC server over IPv%d in %.1f ms\n", 
+        addr.family == AF_INET6 ? 6 : 4, 
+        (EventLoop::NowUs() - connect_start_us) / 1000.0);
+    BeginLogin();
+}
+
+void TwitchLink::CancelAttempts() {
+    if (attempt_timer != 0) {
+        loop->CancelTimer(attempt_timer);
+        attempt_timer = 0;
+    }
+    for (size_t i = 0; i < attempts.size(); i++) {
+        loop->Unwatch(attempts[i].sock);
+        NetCloseSocket(attempts[i].sock);
+    }
+    attempts.clear();
+}
+
+void TwitchLink::BeginLogin() {
+    ResetRx();
+    tx_ring.Clear();
+    tx_lines.clear();
+
+    if (tls_ctx != NULL && !tls.Start(tls_ctx, credentials->server.c_str())) {
+        Close();
+        owner->OnLinkClosed(this);
+        return;
+    }
+    if (!engine->Attach(sock, this)) {
+        Close();
+        owner->OnLinkClosed(this);
+        return;
+    }
+    link_state = LINK_REGISTERING;
+    got_welcome = false;
+    got_cap_ack = false;
+    got_join = false;
+
+    // Pipeline the whole handshake into a single write. Twitch handles the
+    // lines in order, so there is no need to wait between them.
+    std::string login = "PASS " + credentials->oauth + "\r\n";
+    login += "NICK " + credentials->nick + "\r\n";
+    login += "CAP REQ :twitch.tv/commands twitch.tv/tags\r\n";
+    login += "JOIN #" + credentials->channel + "\r\n";
+    tx_ring.Write(login.data(), login.size());
+    login_end_pos = tx_ring.GetWritePos();
+
+    link_timer = loop->AddTimer(LOGIN_TIMEOUT_MS, [this]() {
+        link_timer = 0;
+        printf("WARNING: Timed out logging in to Twitch\n");
+        Fail();
+    });
+    Send();
+}
+
+void TwitchLink::OnFrame(uint64_t pos, size_t len) {
+    // Login replies, RECONNECT and what the send rate depends on are
+    // handled here, but like every other line they are still passed on if
+    // this is the link chat goes through. Twitch's PINGs and the replies to
+    // our own are swallowed, they are answered right here so a busy
+    // processing thread can't get us booted.
+    std::string scratch;
+    std::string_view line = rx_ring.View(pos, len, &scratch);
+    if (link_state == LINK_REGISTERING || link_state == LINK_READY) {
+        IrcLine irc;
+        if (link_state == LINK_REGISTERING) {
+            CheckLoginReply(line);
+            if (link_state == LINK_IDLE) return;
+        } else if (ParseIrcLine(line, &irc) && irc.command != "PRIVMSG") {
+            if (irc.command == "RECONNECT") {
+                owner->OnReconnectRequested(this);
+            } else if (irc.command == "PING") {
+                ReplyPing(irc.params);
+                return;
+            } else if (irc.command == "PONG" && CheckPong(irc.params)) {
+                return;
+            } else {
+                CheckChatState(irc);
+            }
+        }
+    }
+
+    if (owner->OnRxFrame(this, line)) {
+        RxFrame frame = { pos, len };
+        rx_frames.push_back(frame);
+    }
+}
+
+void TwitchLink::CheckLoginReply(std::string_view line) {
+    IrcLine irc;
+    if (!ParseIrcLine(line, &irc)) return;
+
+    if (irc.command == "001") {
+        got_welcome = true;
+    } else if (irc.command == "CAP") {
+        if (irc.params.find(" NAK ") != std::string_view::npos) {
+            // Without the tags the mod badge and the NOTICE msg-ids never
+            // arrive, and the send rate couldn't follow them
+            printf("WARNING: Twitch refused the commands and tags "
+                "capabilities\n");
+            Fail();
+            return;
+        }
+        got_cap_ack = true;
+    } else if (irc.command == "JOIN") {
+        if (GetIrcNick(irc.source) == credentials->nick) got_join = true;
+    } else if (irc.command == "PING") {
+        ReplyPing(irc.params);
+    } else if (irc.command == "NOTICE") {
+        const size_t npos = std::string_view::npos;
+        if (irc.params.find("authentication failed") != npos ||
+            irc.params.find("Improperly formatted auth") != npos) {
+            printf("ERROR: Twitch rejected the login credentials\n");
+            Close();
+            owner->OnLinkRejected(this);
+            return;
+        }
+        CheckChatState(irc);
+    } else {
+        CheckChatState(irc);
+    }
+
+    if (got_welcome && got_cap_ack && got_join) {
+        loop->CancelTimer(link_timer);
+        link_timer = 0;
+        link_state = LINK_READY;
+        ScheduleKeepalive();
+        owner->OnLinkReady(this);
+    }
+}
+
+void TwitchLink::CheckChatState(const IrcLine &irc) {
+    // USERSTATE says whether we are a moderator, ROOMSTATE whether slow
+    // mode is on, and a NOTICE may tell us we sent too fast
+    std::string_view channel;
+    if (!irc.params.empty() && irc.params[0] == '#') {
+        channel = irc.params.substr(1, irc.params.find(' ') - 1);
+    }
+    std::string_view value;
+    if (irc.command == "USERSTATE") {
+        bool is_mod = GetIrcTag(irc.tags, "mod", &value) && value == "1";
+        if (GetIrcTag(irc.tags, "badges", &value) && 
+            value.find("broadcaster/") != std::string_view::npos) {
+            is_mod = true;
+        }
+        owner->OnUserState(channel, is_mod);
+    } else if (irc.command == "ROOMSTATE") {
+        if (GetIrcTag(irc.tags, "slow", &value)) {
+            owner->OnSlowMode(channel, 
+                (uint32_t)strtoul(std::string(value).c_str(), NULL, 10));
+        }
+    } else if (irc.command == "NOTICE") {
+        if (GetIrcTag(irc.tags, "msg-id", &value)) {
+            owner->OnNotice(channel, value);
+        }
+    }
+}
+
+void TwitchLink::ScheduleKeepalive() {
+    ping_timer = loop->AddTimer(KEEPALIVE_INTERVAL_MS, [this]() {
+        ping_timer = 0;
+        SendKeepalive();
+    });
+}
+
+void TwitchLink::SendKeepalive() {
+    // Goes straight into the tx ring, a ping stuck behind queued chat would
+    // measure our own backlog instead of the link
+    ping_seq++;
+    char ping[64];
+    int len = snprintf(ping, sizeof(ping), "PING :chipsie-%llu\r\n", 
+        (unsigned long long)ping_seq);
+    tx_ring.Write(ping, (size_t)len);
+    ping_sent_us = EventLoop::NowUs();
+    ping_rx_pos = rx_ring.GetWritePos();
+    ping_extensions = 0;
+    ping_timer = loop->AddTimer(PONG_TIMEOUT_MS, [this]() {
+        ping_timer = 0;
+        OnPongTimeout();
+    });
+    Send();
+}
+
+void TwitchLink::ReplyPing(std::string_view params) {
+    // Skips the tx queue for the same reason as our own pings. Sent once
+    // OnRecv() is done with the frames.
+    std::string pong = "PONG ";
+    pong.append(params.data(), params.size());
+    pong += "\r\n";
+    tx_ring.Write(pong.data(), pong.size());
+}
+
+bool TwitchLink::CheckPong(std::string_view params) {
+    // Twitch echoes the token back as ":tmi.twitch.tv PONG tmi.twitch.tv
+    // :chipsie-<seq>"
+    char token[32];
+    int len = snprintf(token, sizeof(token), ":chipsie-%llu", 
+        (unsigned long long)ping_seq);
+    size_t pos = params.find(':');
+    if (pos == std::string_view::npos) return false;
+    std::string_view echoed = params.substr(pos);
+    if (echoed.compare(0, 9, ":chipsie-") != 0) return false;
+
+    // An old or unknown token still means the link is alive, but only the
+    // reply to the outstanding ping is a meaningful RTT sample. Once the
+    // deadline was extended, the PONG waited behind chat and its time says
+    // more about the flood than about the link.
+    if (ping_timer != 0 && ping_sent_us != 0 && 
+        echoed == std::string_view(token, (size_t)len)) {
+        if (ping_extensions == 0) {
+            owner->OnLinkRtt(EventLoop::NowUs() - ping_sent_us);
+        }
+        ping_sent_us = 0;
+        loop->CancelTimer(ping_timer);
+        ScheduleKeepalive();
+    }
+    return true;
+}
+
+void TwitchLink::OnPongTimeout() {
+    // A flood of chat can hold the PONG up behind it on Twitch's side, so
+    // data still arriving buys the link another round, up to a limit
+    if (rx_ring.GetWritePos() != ping_rx_pos && 
+        ping_extensions < MAX_PONG_EXTENSIONS) {
+        ping_rx_pos = rx_ring.GetWritePos();
+        ping_extensions++;
+        ping_timer = loop->AddTimer(PONG_TIMEOUT_MS, [this]() {
+            ping_timer = 0;
+            OnPongTimeout();
+        });
+        return;
+    }
+
+    printf("WARNING: No PONG from Twitch within %u ms, dropping the link\n",
+        PONG_TIMEOUT_MS * (ping_extensions + 1));
+    dead_link_count++;
+    Fail();
+}
+
+void TwitchLink::Fail() {
+    Close();
+    owner->OnLinkClosed(this);
+}
+
+void TwitchLink::ResetRx() {
+    rx_ring.Clear();
+    rx_frames.clear();
+    rx_line_start = rx_ring.GetWritePos();
+    rx_scan_pos = rx_line_start;
+    rx_discarding = false;
+    if (owner != NULL) owner->OnLinkReset(this);
+}
+
+void TwitchLink::DropOversizeLine() {
+    printf("WARNING: Dropping line longer than %d bytes from Twitch\n",
+        (int)MAX_LINE_SIZE);
+    rx_oversize_count++;
+}
+
+// Static initializers
+const size_t TwitchLink::RX_MIN_SPACE;
+const size_t TwitchLink::MAX_LINE_SIZE;
+const uint32_t TwitchLink::CONNECT_TIMEOUT_MS;
+const uint32_t TwitchLink::ATTEMPT_DELAY_MS;
+const uint32_t TwitchLink::LOGIN_TIMEOUT_MS;
+const uint32_t TwitchLink::DRAIN_TIMEOUT_MS;
+const uint32_t TwitchLink::KEEPALIVE_INTERVAL_MS;
+const uint32_t TwitchLink::PONG_TIMEOUT_MS;
+const uint32_t TwitchLink::MAX_PONG_EXTENSIONS;
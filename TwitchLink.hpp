@@ -0,0 +1,198 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_TWITCH_LINK_HPP
+#define CHIPSIE_TWITCH_LINK_HPP
+
+#include "NetPlatform.hpp"
+#include "EventLoop.hpp"
+#include "IoEngine.hpp"
+#include "IrcLine.hpp"
+#include "RingBuffer.hpp"
+#include "Resolver.hpp"
+#include "TlsSession.hpp"
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+
+class TwitchConn;
+struct AuthData;
+
+// Outbound lines by priority. A lane only gets to send once the lanes
+// above it are empty.
+enum TxLane {
+    TX_LANE_CONTROL, // Protocol lines, e.g. JOIN and PART
+    TX_LANE_MOD, // Moderation actions
+    TX_LANE_CHAT, // Ordinary replies
+    NUM_TX_LANES
+};
+
+// A chat line on its way out, kept until the socket took all of it
+struct TxLine {
+    std::string line;
+    TxLane lane;
+    std::string channel; // Only set for PRIVMSGs, which are rate limited
+    uint64_t queued_us;
+    uint64_t deadline_us; // Not worth sending anymore after this
+    uint64_t end_pos; // Tx ring position right after the line
+};
+
+// A single connection to the Twitch IRC server. Takes care of connecting,
+// logging in, framing received lines and writing out its tx ring, while
+// TwitchConn decides which link is the one chat goes through.
+class TwitchLink : public IoClient {
+public:
+    enum State {
+        LINK_IDLE,
+        LINK_CONNECTING, // Racing non-blocking connects to each address
+        LINK_REGISTERING, // Login sent, waiting on 001, CAP ACK and JOIN
+        LINK_READY,
+        LINK_DRAINING // Replaced by a newer link, flushing what is left
+    };
+
+    TwitchLink();
+    // tls_context is NULL for plaintext connections
+    void Init(TwitchConn *owner_conn, const AuthData *auth_data, 
+        EventLoop *event_loop, IoEngine *io_engine, Resolver *dns,
+        TlsContext *tls_context);
+    // Races connects to the addresses, Happy Eyeballs style. Attempts are
+    // started a short delay apart alternating between IPv6 and IPv4, and the
+    // first one through wins.
+    void Connect(const std::vector<ResolvedAddr> &addrs);
+    // Stops taking new lines and closes once the tx ring is flushed
+    void Drain();
+    // Closes without notifying the owner
+    void Close();
+    State GetState() const { return link_state; }
+    uint64_t GetOversizeCount() const { return rx_oversize_count; }
+    // Links dropped because Twitch stopped answering our PINGs
+    uint64_t GetDeadLinkCount() const { return dead_link_count; }
+
+    RingBuffer *GetTxRing() { return &tx_ring; }
+    // Serializes the line into the tx ring and remembers it until it's sent
+    void WriteLine(TxLine &&tx_line);
+    // Hands back the lines the socket didn't fully take, oldest first
+    void TakeUnsentLines(std::deque<TxLine> *out);
+    // Writes as much of the tx ring as the socket takes, topping it up with
+    // queued lines from the owner in between
+    void Send();
+
+    bool HasRxFrames() const { return !rx_frames.empty(); }
+    // The returned view stays valid until the next call or until the event
+    // loop runs again
+    std::string_view PopRxFrame();
+
+    // IoClient interface, called by the I/O engine
+    char *GetRecvSpace(size_t *out_len) override;
+    void OnRecv(size_t len) override;
+    void OnClosed(int err) override;
+    void OnWritable() override;
+
+private:
+    static const size_t RX_MIN_SPACE = 4096;
+    static const size_t MAX_LINE_SIZE = 65536;
+    static const uint32_t CONNECT_TIMEOUT_MS = 10000;
+    static const uint32_t ATTEMPT_DELAY_MS = 250;
+    static const uint32_t LOGIN_TIMEOUT_MS = 10000;
+    static const uint32_t DRAIN_TIMEOUT_MS = 5000;
+    // A half-open TCP connection can go unnoticed for minutes, so a ready
+    // link pings on its own and gives up if the PONG doesn't come back
+    static const uint32_t KEEPALIVE_INTERVAL_MS = 5000;
+    static const uint32_t PONG_TIMEOUT_MS = 3000;
+    // Rounds of PONG_TIMEOUT_MS that arriving chat can add on top
+    static const uint32_t MAX_PONG_EXTENSIONS = 3;
+
+    struct ConnectAttempt {
+        NetSocket sock;
+        size_t addr_index;
+    };
+
+    struct RxFrame {
+        uint64_t pos;
+        size_t len;
+    };
+
+    TwitchConn *owner;
+    const AuthData *credentials;
+    EventLoop *loop;
+    IoEngine *engine;
+    Resolver *resolver;
+    TlsContext *tls_ctx;
+    TlsSession tls;
+
+    NetSocket sock;
+    State link_state;
+    TimerId link_timer; // Deadline of the current connect, login or drain
+    TimerId ping_timer; // Next keepalive PING, or the PONG deadline
+    uint64_t ping_seq;
+    uint64_t ping_sent_us; // 0 once the PONG came back
+    uint64_t ping_rx_pos; // Rx ring write position when the PING went out
+    uint32_t ping_extensions; // Rounds added to the PONG deadline so far
+    uint64_t dead_link_count;
+    bool got_welcome;
+    bool got_cap_ack;
+    bool got_join;
+    uint64_t login_end_pos; // Tx ring position after the login, 0 once sent
+    std::vector<ResolvedAddr> connect_addrs; // Families interleaved
+    size_t connect_index; // Next address to start an attempt on
+    std::vector<ConnectAttempt> attempts; // Connects still in flight
+    TimerId attempt_timer; // Starts the next attempt if none finished
+    uint64_t connect_start_us;
+    int connect_err;
+
+    RingBuffer rx_ring;
+    std::deque<RxFrame> rx_frames;
+    uint64_t rx_line_start; // Ring position of the line being received
+    uint64_t rx_scan_pos; // Everything before this was searched for LF
+    bool rx_discarding; // Skipping the rest of an oversize line
+    std::string rx_wrap_line; // Copy of a frame that wraps around the ring
+    uint64_t rx_oversize_count;
+
+    RingBuffer tx_ring; // Serialized lines the socket hasn't taken yet
+    std::deque<TxLine> tx_lines; // Chat lines with bytes still in tx_ring
+
+    bool EncryptTxRing();
+    void ReleaseSentLines();
+    char *GetPlainSpace(size_t *out_len);
+    void OnPlainRecv(size_t len);
+    void StartAttempt();
+    void OnAttemptEvent(NetSocket attempt_sock, uint32_t events);
+    void CancelAttempts();
+    void BeginLogin();
+    void OnFrame(uint64_t pos, size_t len);
+    void CheckLoginReply(std::string_view line);
+    void CheckChatState(const IrcLine &irc);
+    void ScheduleKeepalive();
+    void SendKeepalive();
+    void ReplyPing(std::string_view params);
+    bool CheckPong(std::string_view params);
+    void OnPongTimeout();
+    void Fail();
+    void ResetRx();
+    void DropOversizeLine();
+};
+
+#endif // CHIPSIE_TWITCH_LINK_HPP
@@ -0,0 +1,515 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef __linux__
+
+#include "UringEngine.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+// glibc doesn't wrap the io_uring syscalls, so call them directly
+static int IoUringSetup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, 
+        flags, NULL, 0);
+}
+
+static int IoUringRegister(int fd, unsigned opcode, void *arg, 
+    unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t PackUserData(int op, int conn_index, int slot) {
+    return ((uint64_t)op << 32) | ((uint64_t)conn_index << 16) | 
+        (uint64_t)(slot & 0xffff);
+}
+
+UringEngine::UringEngine(EventLoop *event_loop) {
+    loop = event_loop;
+    ring_fd = -1;
+    sq_ptr = MAP_FAILED;
+    cq_ptr = MAP_FAILED;
+    sqes = (struct io_uring_sqe *)MAP_FAILED;
+    sq_size = 0;
+    cq_size = 0;
+    sqes_size = 0;
+    sqe_tail = 0;
+    to_submit = 0;
+    buffers = NULL;
+    for (int i = 0; i < MAX_CONNS; i++) {
+        conns[i].sock = NET_INVALID_SOCKET;
+        conns[i].client = NULL;
+        conns[i].attached = false;
+        conns[i].recv_pending = false;
+        conns[i].send_pending = false;
+        conns[i].cancel_owed = false;
+        conns[i].want_write = false;
+        conns[i].inflight_ops = 0;
+        conns[i].rx_offset = 0;
+        conns[i].rx_len = 0;
+    }
+}
+
+UringEngine::~UringEngine() {
+    Shutdown();
+}
+
+bool UringEngine::Init() {
+    struct io_uring_params params = { };
+    ring_fd = IoUringSetup(QUEUE_DEPTH, &params);
+    if (ring_fd < 0) {
+        printf("WARNING: io_uring_setup failed: %d\n", errno);
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        printf("WARNING: Kernel io_uring is too old for Chipsie\n");
+        Shutdown();
+        return false;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + 
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > sq_size) sq_size = cq_size;
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, 
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        printf("WARNING: Failed to map io_uring rings: %d\n", errno);
+        Shutdown();
+        return false;
+    }
+    // Single mmap kernels share one mapping for both rings
+    cq_ptr = sq_ptr;
+    cq_size = 0;
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *)mmap(NULL, sqes_size, 
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, 
+        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        printf("WARNING: Failed to map io_uring SQEs: %d\n", errno);
+        Shutdown();
+        return false;
+    }
+
+    char *sq_base = (char *)sq_ptr;
+    sq_head = (unsigned *)(sq_base + params.sq_off.head);
+    sq_tail = (unsigned *)(sq_base + params.sq_off.tail);
+    sq_mask = (unsigned *)(sq_base + params.sq_off.ring_mask);
+    sq_entries = (unsigned *)(sq_base + params.sq_off.ring_entries);
+    sq_array = (unsigned *)(sq_base + params.sq_off.array);
+    char *cq_base = (char *)cq_ptr;
+    cq_head = (unsigned *)(cq_base + params.cq_off.head);
+    cq_tail = (unsigned *)(cq_base + params.cq_off.tail);
+    cq_mask = (unsigned *)(cq_base + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq_base + params.cq_off.cqes);
+    sqe_tail = *sq_tail;
+
+    // One rx buffer per connection followed by the shared tx slots, all
+    // registered up front so the kernel doesn't pin pages on every op
+    size_t total = MAX_CONNS * RX_SLOT_SIZE + TX_SLOTS * TX_SLOT_SIZE;
+    buffers = (char *)malloc(total);
+    if (buffers == NULL) {
+        printf("WARNING: Failed to allocate io_uring buffers\n");
+        Shutdown();
+        return false;
+    }
+    struct iovec iovs[MAX_CONNS + TX_SLOTS];
+    for (int i = 0; i < MAX_CONNS + TX_SLOTS; i++) {
+        iovs[i].iov_base = GetBuffer(i);
+        iovs[i].iov_len = i < MAX_CONNS ? RX_SLOT_SIZE : TX_SLOT_SIZE;
+    }
+    stats.syscalls++;
+    int rc = IoUringRegister(ring_fd, IORING_REGISTER_BUFFERS, iovs, 
+        MAX_CONNS + TX_SLOTS);
+    if (rc < 0) {
+        printf("WARNING: Failed to register io_uring buffers: %d\n", errno);
+        Shutdown();
+        return false;
+    }
+    for (int i = TX_SLOTS - 1; i >= 0; i--) {
+        free_tx_slots.push_back(MAX_CONNS + i);
+    }
+
+    if (!loop->Watch(ring_fd, EV_READ, 
+        [this](uint32_t) { OnRingReadable(); })) {
+        Shutdown();
+        return false;
+    }
+    loop->AddPrepareHandler([this]() {
+        RunBufferedRecvs();
+        RunWritableCallbacks();
+        RetrySends();
+        RetryCancels();
+        Submit();
+    });
+    return true;
+}
+
+const char *UringEngine::GetName() const {
+    return "uring";
+}
+
+bool UringEngine::Attach(NetSocket sock, IoClient *client) {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        Conn &conn = conns[i];
+        // The kernel may still own the buffers of a recently detached conn
+        if (conn.attached || conn.inflight_ops > 0) continue;
+        conn.sock = sock;
+        conn.client = client;
+        conn.attached = true;
+        conn.cancel_owed = false;
+        conn.want_write = false;
+        conn.rx_offset = 0;
+        conn.rx_len = 0;
+        QueueRecv(i);
+        return true;
+    }
+    printf("WARNING: io_uring engine is out of connection slots\n");
+    return false;
+}
+
+void UringEngine::Detach(NetSocket sock) {
+    Conn *conn = FindConn(sock);
+    if (conn == NULL) return;
+    conn->attached = false;
+    conn->client = NULL;
+    conn->want_write = false;
+    conn->rx_len = 0;
+    if (conn->recv_pending) QueueCancel((int)(conn - conns));
+    // With a write in flight its completion gives the slots back
+    if (!conn->send_pending) {
+        for (size_t i = 0; i < conn->tx_chunks.size(); i++) {
+            free_tx_slots.push_back(conn->tx_chunks[i].slot);
+        }
+        conn->tx_chunks.clear();
+    }
+}
+
+int UringEngine::Send(NetSocket sock, const IoVec *vecs, int count) {
+    Conn *conn = FindConn(sock);
+    if (conn == NULL) return -1;
+
+    // Pack the buffers back to back into free tx slots. The whole batch then
+    // goes out as a handful of fixed writes in the next submission.
+    size_t taken = 0;
+    TxChunk *chunk = NULL;
+    for (int i = 0; i < count; i++) {
+        size_t offset = 0;
+        while (offset < vecs[i].len) {
+            if (chunk == NULL || chunk->len == TX_SLOT_SIZE) {
+                if (free_tx_slots.empty()) break;
+                TxChunk new_chunk;
+                new_chunk.slot = free_tx_slots.back();
+                new_chunk.offset = 0;
+                new_chunk.len = 0;
+                free_tx_slots.pop_back();
+                conn->tx_chunks.push_back(new_chunk);
+                chunk = &conn->tx_chunks.back();
+            }
+            size_t len = vecs[i].len - offset;
+            if (len > TX_SLOT_SIZE - chunk->len) {
+                len = TX_SLOT_SIZE - chunk->len;
+            }
+            memcpy(GetBuffer(chunk->slot) + chunk->len, &vecs[i].data[offset],
+                len);
+            chunk->len += len;
+            offset += len;
+            taken += len;
+        }
+        if (offset < vecs[i].len) break;
+    }
+
+    if (!conn->send_pending) QueueSend((int)(conn - conns));
+    return (int)taken;
+}
+
+size_t UringEngine::GetPendingSend(NetSocket sock) {
+    Conn *conn = FindConn(sock);
+    if (conn == NULL) return 0;
+    size_t pending = 0;
+    for (size_t i = 0; i < conn->tx_chunks.size(); i++) {
+        pending += conn->tx_chunks[i].len;
+    }
+    return pending;
+}
+
+void UringEngine::SetWantWrite(NetSocket sock, bool want_write) {
+    Conn *conn = FindConn(sock);
+    if (conn != NULL) conn->want_write = want_write;
+}
+
+void UringEngine::Shutdown() {
+    if (ring_fd >= 0) {
+        loop->Unwatch(ring_fd);
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+    sqes = (struct io_uring_sqe *)MAP_FAILED;
+    sq_ptr = MAP_FAILED;
+    cq_ptr = MAP_FAILED;
+    free(buffers);
+    buffers = NULL;
+}
+
+UringEngine::Conn *UringEngine::FindConn(NetSocket sock) {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        if (conns[i].attached && conns[i].sock == sock) return &conns[i];
+    }
+    return NULL;
+}
+
+char *UringEngine::GetBuffer(int buf_index) {
+    if (buf_index < MAX_CONNS) return &buffers[buf_index * RX_SLOT_SIZE];
+    return &buffers[MAX_CONNS * RX_SLOT_SIZE + 
+        (buf_index - MAX_CONNS) * TX_SLOT_SIZE];
+}
+
+struct io_uring_sqe *UringEngine::GetSqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sqe_tail - head >= *sq_entries) {
+        // Ring is full, push what we have so far to make room
+        Submit();
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sqe_tail - head >= *sq_entries) return NULL;
+    }
+    unsigned index = sqe_tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sqe_tail++;
+    to_submit++;
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+void UringEngine::Submit() {
+    if (to_submit == 0) return;
+    stats.syscalls++;
+    int rc = IoUringEnter(ring_fd, to_submit, 0, 0);
+    if (rc < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            printf("WARNING: io_uring_enter failed: %d\n", errno);
+        }
+        return;
+    }
+    to_submit -= rc;
+}
+
+void UringEngine::QueueRecv(int conn_index) {
+    Conn &conn = conns[conn_index];
+    struct io_uring_sqe *sqe = GetSqe();
+    if (sqe == NULL) {
+        printf("WARNING: io_uring submission queue overflow\n");
+        return;
+    }
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = conn.sock;
+    sqe->addr = (uint64_t)(uintptr_t)GetBuffer(conn_index);
+    sqe->len = RX_SLOT_SIZE;
+    if (sqe->len > recv_budget) sqe->len = (uint32_t)recv_budget;
+    sqe->buf_index = (uint16_t)conn_index;
+    sqe->user_data = PackUserData(OP_RECV, conn_index, conn_index);
+    conn.recv_pending = true;
+    conn.inflight_ops++;
+}
+
+void UringEngine::QueueSend(int conn_index) {
+    Conn &conn = conns[conn_index];
+    if (conn.tx_chunks.empty()) return;
+    struct io_uring_sqe *sqe = GetSqe();
+    if (sqe == NULL) {
+        printf("WARNING: io_uring submission queue overflow\n");
+        return;
+    }
+
+    // Only one write per socket is ever in flight so bytes stay in order
+    TxChunk &chunk = conn.tx_chunks.front();
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = conn.sock;
+    sqe->addr = (uint64_t)(uintptr_t)(GetBuffer(chunk.slot) + chunk.offset);
+    sqe->len = (uint32_t)chunk.len;
+    sqe->buf_index = (uint16_t)chunk.slot;
+    sqe->user_data = PackUserData(OP_SEND, conn_index, chunk.slot);
+    conn.send_pending = true;
+    conn.inflight_ops++;
+}
+
+void UringEngine::QueueCancel(int conn_index) {
+    Conn &conn = conns[conn_index];
+    struct io_uring_sqe *sqe = GetSqe();
+    if (sqe == NULL) {
+        // The conn's slot stays taken until the recv ends, so keep trying
+        if (!conn.cancel_owed) {
+            printf("WARNING: io_uring submission queue overflow, retrying "
+                "a cancel\n");
+        }
+        conn.cancel_owed = true;
+        return;
+    }
+    conn.cancel_owed = false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = PackUserData(OP_RECV, conn_index, conn_index);
+    sqe->user_data = PackUserData(OP_CANCEL, conn_index, 0);
+}
+
+void UringEngine::OnRingReadable() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        int op = (int)(cqe->user_data >> 32);
+        int conn_index = (int)((cqe->user_data >> 16) & 0xffff);
+        int res = cqe->res;
+        head++;
+        // Release the entry before running client code that may queue more
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        if (op == OP_RECV) CompleteRecv(conn_index, res);
+        else if (op == OP_SEND) CompleteSend(conn_index, res);
+        tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+void UringEngine::CompleteRecv(int conn_index, int res) {
+    Conn &conn = conns[conn_index];
+    conn.recv_pending = false;
+    conn.inflight_ops--;
+    if (!conn.attached) return;
+
+    if (res == 0) {
+        conn.client->OnClosed(0);
+        return;
+    } else if (res < 0) {
+        conn.client->OnClosed(-res);
+        return;
+    }
+
+    stats.rx_bytes += res;
+    conn.rx_offset = 0;
+    conn.rx_len = (size_t)res;
+    DeliverRecv(conn_index);
+}
+
+void UringEngine::DeliverRecv(int conn_index) {
+    // The client may have less room than was read. What doesn't fit waits
+    // in the rx slot, and the socket isn't read again until the client
+    // took all of it.
+    Conn &conn = conns[conn_index];
+    const char *data = GetBuffer(conn_index);
+    while (conn.rx_len > 0 && conn.attached) {
+        size_t space = 0;
+        char *dest = conn.client->GetRecvSpace(&space);
+        if (space == 0) return;
+        if (space > conn.rx_len) space = conn.rx_len;
+        memcpy(dest, data + conn.rx_offset, space);
+        conn.rx_offset += space;
+        conn.rx_len -= space;
+        conn.client->OnRecv(space);
+    }
+    if (conn.attached) QueueRecv(conn_index);
+}
+
+void UringEngine::RunBufferedRecvs() {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        Conn &conn = conns[i];
+        if (!conn.attached || conn.rx_len == 0) continue;
+        // Lets the client work off what it holds, which makes the room
+        conn.client->OnRecv(0);
+        DeliverRecv(i);
+    }
+}
+
+void UringEngine::CompleteSend(int conn_index, int res) {
+    Conn &conn = conns[conn_index];
+    conn.send_pending = false;
+    conn.inflight_ops--;
+
+    if (res <= 0 || !conn.attached) {
+        // Connection is gone, give all of its tx slots back
+        for (size_t i = 0; i < conn.tx_chunks.size(); i++) {
+            free_tx_slots.push_back(conn.tx_chunks[i].slot);
+        }
+        conn.tx_chunks.clear();
+        if (conn.attached) conn.client->OnClosed(res < 0 ? -res : 0);
+        return;
+    }
+
+    stats.tx_bytes += res;
+    TxChunk &chunk = conn.tx_chunks.front();
+    chunk.offset += res;
+    chunk.len -= res;
+    if (chunk.len == 0) {
+        free_tx_slots.push_back(chunk.slot);
+        conn.tx_chunks.pop_front();
+    }
+    if (!conn.tx_chunks.empty()) {
+        QueueSend(conn_index);
+        return;
+    }
+    // Everything the client handed over is written, e.g. a draining link
+    // waits for this before it closes the socket
+    conn.client->OnWritable();
+}
+
+void UringEngine::RetrySends() {
+    // Chunks whose write didn't fit into a full submission queue
+    for (int i = 0; i < MAX_CONNS; i++) {
+        Conn &conn = conns[i];
+        if (!conn.attached || conn.send_pending) continue;
+        QueueSend(i);
+    }
+}
+
+void UringEngine::RetryCancels() {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        Conn &conn = conns[i];
+        if (!conn.cancel_owed) continue;
+        // Nothing left to cancel once the recv completed on its own
+        if (conn.recv_pending) QueueCancel(i);
+        else conn.cancel_owed = false;
+    }
+}
+
+void UringEngine::RunWritableCallbacks() {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        Conn &conn = conns[i];
+        if (!conn.attached || !conn.want_write) continue;
+        if (free_tx_slots.empty()) continue;
+        conn.client->OnWritable();
+    }
+}
+
+#endif // __linux__
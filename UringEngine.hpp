@@ -0,0 +1,131 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_URING_ENGINE_HPP
+#define CHIPSIE_URING_ENGINE_HPP
+
+#ifdef __linux__
+
+#include "IoEngine.hpp"
+#include <linux/io_uring.h>
+#include <deque>
+#include <vector>
+
+// Completion based engine on top of io_uring. Every attached socket keeps one
+// READ_FIXED outstanding into its own registered buffer and outgoing data is
+// copied into registered tx slots. All SQEs queued during a loop pass are
+// submitted with a single io_uring_enter right before the loop sleeps, and
+// completions are reaped from the shared ring without any syscall at all.
+class UringEngine : public IoEngine {
+public:
+    explicit UringEngine(EventLoop *event_loop);
+    ~UringEngine();
+    bool Init();
+    const char *GetName() const override;
+    bool Attach(NetSocket sock, IoClient *client) override;
+    void Detach(NetSocket sock) override;
+    int Send(NetSocket sock, const IoVec *vecs, int count) override;
+    size_t GetPendingSend(NetSocket sock) override;
+    void SetWantWrite(NetSocket sock, bool want_write) override;
+    void Shutdown() override;
+
+private:
+    static const unsigned QUEUE_DEPTH = 64;
+    static const int MAX_CONNS = 8;
+    static const size_t RX_SLOT_SIZE = 16384;
+    static const int TX_SLOTS = 32;
+    static const size_t TX_SLOT_SIZE = 4096;
+
+    enum OpType {
+        OP_RECV,
+        OP_SEND,
+        OP_CANCEL
+    };
+
+    struct TxChunk {
+        int slot;
+        size_t offset;
+        size_t len;
+    };
+
+    struct Conn {
+        NetSocket sock;
+        IoClient *client;
+        bool attached;
+        bool recv_pending;
+        bool send_pending;
+        bool cancel_owed; // The recv's cancel didn't fit into the queue
+        bool want_write;
+        int inflight_ops;
+        // Read bytes the client had no room for yet, kept in the conn's rx
+        // slot. No recv is queued until they are all handed over.
+        size_t rx_offset;
+        size_t rx_len;
+        std::deque<TxChunk> tx_chunks;
+    };
+
+    EventLoop *loop;
+    int ring_fd;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_entries;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail;
+    unsigned to_submit;
+
+    char *buffers;
+    Conn conns[MAX_CONNS];
+    std::vector<int> free_tx_slots;
+
+    Conn *FindConn(NetSocket sock);
+    char *GetBuffer(int buf_index);
+    struct io_uring_sqe *GetSqe();
+    void Submit();
+    void QueueRecv(int conn_index);
+    void QueueSend(int conn_index);
+    void QueueCancel(int conn_index);
+    void OnRingReadable();
+    void CompleteRecv(int conn_index, int res);
+    void DeliverRecv(int conn_index);
+    void RunBufferedRecvs();
+    void CompleteSend(int conn_index, int res);
+    void RetrySends();
+    void RetryCancels();
+    void RunWritableCallbacks();
+};
+
+#endif // __linux__
+
+#endif // CHIPSIE_URING_ENGINE_HPP
@@ -0,0 +1,100 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Wakeup.hpp"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif // __linux__
+
+Wakeup::Wakeup() {
+    handle = NET_INVALID_SOCKET;
+}
+
+bool Wakeup::Init() {
+#ifdef __linux__
+    handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (handle < 0) {
+        printf("ERROR: Failed to create eventfd: %d\n", errno);
+        handle = NET_INVALID_SOCKET;
+        return false;
+    }
+#else
+    handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (handle == NET_INVALID_SOCKET) {
+        printf("ERROR: Failed to create wakeup socket: %d\n", 
+            NetGetLastError());
+        return false;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(handle, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(handle, (sockaddr *)&addr, &addr_len) != 0 ||
+        connect(handle, (sockaddr *)&addr, addr_len) != 0 ||
+        !NetSetNonBlocking(handle)) {
+        printf("ERROR: Failed to set up wakeup socket: %d\n", 
+            NetGetLastError());
+        NetCloseSocket(handle);
+        handle = NET_INVALID_SOCKET;
+        return false;
+    }
+#endif // __linux__
+    return true;
+}
+
+void Wakeup::Signal() {
+#ifdef __linux__
+    uint64_t one = 1;
+    // Only fails if the counter is about to overflow, which still wakes
+    ssize_t rc = write(handle, &one, sizeof(one));
+    (void)rc;
+#else
+    char byte = 1;
+    send(handle, &byte, 1, 0);
+#endif // __linux__
+}
+
+void Wakeup::Clear() {
+#ifdef __linux__
+    uint64_t count;
+    ssize_t rc = read(handle, &count, sizeof(count));
+    (void)rc;
+#else
+    char buf[64];
+    while (recv(handle, buf, sizeof(buf), 0) > 0) {}
+#endif // __linux__
+}
+
+void Wakeup::Shutdown() {
+    if (handle == NET_INVALID_SOCKET) return;
+    NetCloseSocket(handle);
+    handle = NET_INVALID_SOCKET;
+}
@@ -0,0 +1,48 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_WAKEUP_HPP
+#define CHIPSIE_WAKEUP_HPP
+
+#include "NetPlatform.hpp"
+
+// Lets one thread wake up another thread's EventLoop. Signals that arrive
+// before the loop gets around to Clear() collapse into one wakeup. Uses an
+// eventfd on Linux and a loopback UDP socket talking to itself elsewhere,
+// since select() on Windows only takes sockets.
+class Wakeup {
+public:
+    Wakeup();
+    bool Init();
+    void Signal();
+    void Clear();
+    // Watch this for EV_READ
+    NetSocket GetHandle() const { return handle; }
+    void Shutdown();
+
+private:
+    NetSocket handle;
+};
+
+#endif // CHIPSIE_WAKEUP_HPP
@@ -0,0 +1,323 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "WorkerPool.hpp"
+#include "EventLoop.hpp"
+#include <stdio.h>
+#include <algorithm>
+
+WorkerPool::WorkerPool() {
+    next_worker = 0;
+    pending_jobs = 0;
+    runnable_count = 0;
+    stopping = false;
+    processed_count = 0;
+    steal_count = 0;
+    stats_start_ms = 0;
+    stats_start_steals = 0;
+    stats_start_count = 0;
+}
+
+int WorkerPool::GetDefaultWorkers() {
+    int cores = (int)std::thread::hardware_concurrency();
+    if (cores < 1) return 1;
+    return cores < 8 ? cores : 8;
+}
+
+bool WorkerPool::Start(int num_workers) {
+    if (num_workers < 1 || num_workers > MAX_WORKERS) {
+        printf("ERROR: Worker count must be between 1 and %d\n", 
+            MAX_WORKERS);
+        return false;
+    }
+    stopping = false;
+    stats_start_ms = EventLoop::NowMs();
+    for (int i = 0; i < num_workers; i++) {
+        workers.emplace_back(new Worker());
+    }
+    // Only start them once the vector stops moving, they steal from it
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread = std::thread(&WorkerPool::RunWorker, this, i);
+    }
+    return true;
+}
+
+void WorkerPool::Submit(std::string_view key, Job &&job) {
+    std::unique_lock<std::mutex> guard(strand_lock);
+    space_cv.wait(guard, [this]() {
+        return pending_jobs < MAX_PENDING_JOBS || stopping;
+    });
+    if (stopping) return;
+
+    Strand *strand = GetStrand(key);
+    strand->jobs.push_back(std::move(job));
+    pending_jobs++;
+    if (strand->scheduled) return; // Whoever has it picks the job up
+
+    strand->scheduled = true;
+    size_t index = next_worker++ % workers.size();
+    guard.unlock();
+    Schedule(strand, index);
+}
+
+bool WorkerPool::TrySubmit(std::string_view key, Job &&job) {
+    // A flooded key fills its own strand and loses its own jobs, without
+    // holding up the caller and with it every other key
+    std::unique_lock<std::mutex> guard(strand_lock);
+    if (stopping) return false;
+    Strand *strand = GetStrand(key);
+    if (pending_jobs >= MAX_PENDING_JOBS || 
+        strand->jobs.size() >= MAX_STRAND_JOBS) {
+        strand->dropped_count++;
+        return false;
+    }
+    strand->jobs.push_back(std::move(job));
+    pending_jobs++;
+    if (strand->scheduled) return true;
+
+    strand->scheduled = true;
+    size_t index = next_worker++ % workers.size();
+    guard.unlock();
+    Schedule(strand, index);
+    return true;
+}
+
+void WorkerPool::SetShare(std::string_view key, uint32_t share) {
+    std::lock_guard<std::mutex> guard(strand_lock);
+    GetStrand(key)->share = share > 0 ? share : 1;
+}
+
+WorkerPool::Strand *WorkerPool::GetStrand(std::string_view key) {
+    // Caller holds strand_lock
+    std::unique_ptr<Strand> &slot = strands[std::string(key)];
+    if (!slot) {
+        slot.reset(new Strand());
+        slot->key = std::string(key);
+        slot->scheduled = false;
+        slot->share = DEFAULT_SHARE;
+        slot->deficit_us = 0;
+        slot->job_count = 0;
+        slot->busy_us = 0;
+        slot->dropped_count = 0;
+    }
+    return slot.get();
+}
+
+void WorkerPool::Shutdown() {
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    {
+        std::lock_guard<std::mutex> guard(strand_lock);
+    }
+    space_cv.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i]->thread.joinable()) workers[i]->thread.join();
+    }
+    if (processed_count != stats_start_count) ReportStats();
+    workers.clear();
+    strands.clear();
+    pending_jobs = 0;
+    runnable_count = 0;
+}
+
+void WorkerPool::RunWorker(size_t index) {
+    std::vector<Job> batch;
+    batch.reserve(BATCH_SIZE);
+    while (!stopping) {
+        Strand *strand = TakeStrand(index);
+        if (strand == NULL) {
+            std::unique_lock<std::mutex> guard(idle_lock);
+            work_cv.wait(guard, [this]() {
+                return runnable_count > 0 || stopping;
+            });
+            continue;
+        }
+
+        // Batching keeps the locking off the per job cost. Each turn the
+        // strand gets a quantum of run time per share and runs jobs until
+        // it has used it up, whatever it overdraws comes off its next
+        // turns. An overdrawn strand sits them out at the back while the
+        // others run. With no other strand waiting there is nobody to be
+        // fair to, so its debt is written off rather than spinning through
+        // empty turns. Jobs it didn't get to go back to the front.
+        bool others_waiting = false;
+        {
+            std::lock_guard<std::mutex> guard(idle_lock);
+            others_waiting = runnable_count > 0;
+        }
+        int64_t deficit_us = 0;
+        bool sit_out = false;
+        {
+            std::lock_guard<std::mutex> guard(strand_lock);
+            int64_t quantum_us = strand->share * QUANTUM_US;
+            strand->deficit_us += quantum_us;
+            if (strand->deficit_us <= 0 && !others_waiting) {
+                strand->deficit_us = quantum_us;
+            }
+            deficit_us = strand->deficit_us;
+            sit_out = deficit_us <= 0;
+            size_t max_jobs = sit_out ? 0 : BATCH_SIZE * strand->share;
+            while (!strand->jobs.empty() && batch.size() < max_jobs) {
+                batch.push_back(std::move(strand->jobs.front()));
+                strand->jobs.pop_front();
+            }
+        }
+        if (sit_out) {
+            Schedule(strand, index);
+            continue;
+        }
+        size_t run = 0;
+        uint64_t busy_us = 0;
+        while (run < batch.size() && deficit_us > 0) {
+            uint64_t start_us = EventLoop::NowUs();
+            batch[run++]();
+            uint64_t job_us = EventLoop::NowUs() - start_us;
+            busy_us += job_us;
+            deficit_us -= (int64_t)job_us;
+        }
+
+        bool more = false;
+        {
+            std::lock_guard<std::mutex> guard(strand_lock);
+            for (size_t i = batch.size(); i > run; i--) {
+                strand->jobs.push_front(std::move(batch[i - 1]));
+            }
+            pending_jobs -= run;
+            strand->job_count += run;
+            strand->busy_us += busy_us;
+            more = !strand->jobs.empty();
+            // Credit left over only carries while there is work for it
+            // and never past one quantum, or an idle strand saves up
+            int64_t quantum_us = strand->share * QUANTUM_US;
+            if (!more) {
+                strand->deficit_us = 0;
+            } else {
+                strand->deficit_us = std::min(deficit_us, quantum_us);
+            }
+            if (!more) strand->scheduled = false;
+        }
+        space_cv.notify_one();
+        if (more) Schedule(strand, index);
+
+        uint64_t before = processed_count.fetch_add(run);
+        if (before / STATS_INTERVAL_JOBS != 
+            (before + run) / STATS_INTERVAL_JOBS) {
+            ReportStats();
+        }
+        batch.clear();
+    }
+}
+
+void WorkerPool::Schedule(Strand *strand, size_t index) {
+    {
+        std::lock_guard<std::mutex> guard(workers[index]->lock);
+        workers[index]->run_queue.push_back(strand);
+    }
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        runnable_count++;
+    }
+    work_cv.notify_one();
+}
+
+WorkerPool::Strand *WorkerPool::TakeStrand(size_t index) {
+    // Own queue from the front, so strands take turns in order. Steals come
+    // off the back of the others.
+    Strand *strand = NULL;
+    {
+        Worker *worker = workers[index].get();
+        std::lock_guard<std::mutex> guard(worker->lock);
+        if (!worker->run_queue.empty()) {
+            strand = worker->run_queue.front();
+            worker->run_queue.pop_front();
+        }
+    }
+    for (size_t i = 1; strand == NULL && i < workers.size(); i++) {
+        Worker *victim = workers[(index + i) % workers.size()].get();
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (!victim->run_queue.empty()) {
+            strand = victim->run_queue.back();
+            victim->run_queue.pop_back();
+            steal_count++;
+        }
+    }
+    if (strand != NULL) {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        runnable_count--;
+    }
+    return strand;
+}
+
+void WorkerPool::ReportStats() {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    uint64_t now_ms = EventLoop::NowMs();
+    uint64_t steals = steal_count;
+    uint64_t count = processed_count;
+    uint64_t jobs = count - stats_start_count;
+    double secs = (now_ms - stats_start_ms) / 1000.0;
+    printf("STATS: %d workers, %llu jobs run in %.2f s (%.0f/sec), "
+        "%llu strands stolen\n", (int)workers.size(), 
+        (unsigned long long)jobs, secs, secs > 0 ? jobs / secs : 0.0,
+        (unsigned long long)(steals - stats_start_steals));
+    stats_start_ms = now_ms;
+    stats_start_steals = steals;
+    stats_start_count = count;
+
+    // Busy is the share of wall time spent on the strand's jobs. Strands
+    // that went idle are dropped once reported, unless they were given a
+    // share, so keys that come and go don't pile up.
+    std::lock_guard<std::mutex> strand_guard(strand_lock);
+    for (auto it = strands.begin(); it != strands.end(); ) {
+        Strand *strand = it->second.get();
+        if (strand->job_count == 0 && strand->dropped_count == 0) {
+            if (!strand->scheduled && strand->share == DEFAULT_SHARE) {
+                it = strands.erase(it);
+            } else {
+                ++it;
+            }
+            continue;
+        }
+        printf("STATS: strand \"%s\", share %u, %llu jobs, %.1f%% busy, "
+            "%llu jobs dropped\n", strand->key.c_str(), strand->share, 
+            (unsigned long long)strand->job_count,
+            secs > 0 ? strand->busy_us / (secs * 10000.0) : 0.0,
+            (unsigned long long)strand->dropped_count);
+        strand->job_count = 0;
+        strand->busy_us = 0;
+        strand->dropped_count = 0;
+        ++it;
+    }
+}
+
+// Static initializers
+const int WorkerPool::MAX_WORKERS;
+const size_t WorkerPool::MAX_PENDING_JOBS;
+const uint32_t WorkerPool::DEFAULT_SHARE;
+const size_t WorkerPool::BATCH_SIZE;
+const size_t WorkerPool::MAX_STRAND_JOBS;
+const int64_t WorkerPool::QUANTUM_US;
+const uint64_t WorkerPool::STATS_INTERVAL_JOBS;
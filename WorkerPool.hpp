@@ -0,0 +1,123 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Aaron C. Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CHIPSIE_WORKER_POOL_HPP
+#define CHIPSIE_WORKER_POOL_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs jobs on several threads. Jobs are submitted with a key, e.g. the
+// channel, and jobs sharing a key run one at a time in the order they came
+// in while different keys run in parallel. Each key's jobs form a strand.
+// A runnable strand sits in one worker's run queue, and workers that run
+// dry steal strands from the others. Strands take turns by deficit round
+// robin over the time their jobs take, so a key with slow or many jobs
+// gets no more of a worker than its share.
+class WorkerPool {
+public:
+    typedef std::function<void()> Job;
+
+    static const int MAX_WORKERS = 64;
+    static const uint32_t DEFAULT_SHARE = 1;
+
+    WorkerPool();
+    bool Start(int num_workers);
+    // Blocks while the pool already holds too many jobs
+    void Submit(std::string_view key, Job &&job);
+    // Doesn't block, false if the pool or the key's strand is full
+    bool TrySubmit(std::string_view key, Job &&job);
+    // Weight of the key's strand next to the others, 1 by default
+    void SetShare(std::string_view key, uint32_t share);
+    // Jobs that haven't run yet are dropped
+    void Shutdown();
+    int GetNumWorkers() const { return (int)workers.size(); }
+
+    // Somewhere between 1 and 8, depending on the number of cores
+    static int GetDefaultWorkers();
+
+private:
+    static const size_t MAX_PENDING_JOBS = 65536;
+    static const size_t BATCH_SIZE = 32;
+    static const size_t MAX_STRAND_JOBS = 4096; // For TrySubmit()
+    static const int64_t QUANTUM_US = 2000; // Per turn and share
+    static const uint64_t STATS_INTERVAL_JOBS = 10000;
+
+    struct Strand {
+        std::string key;
+        std::deque<Job> jobs;
+        bool scheduled; // In a run queue or being worked on
+        uint32_t share;
+        int64_t deficit_us; // Run time left this turn, less if overdrawn
+        uint64_t job_count;
+        uint64_t busy_us;
+        uint64_t dropped_count;
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::mutex lock;
+        std::deque<Strand *> run_queue;
+    };
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    size_t next_worker; // Guarded by strand_lock
+
+    // Guards the strands and the jobs in them
+    std::mutex strand_lock;
+    std::unordered_map<std::string, std::unique_ptr<Strand> > strands;
+    size_t pending_jobs;
+    std::condition_variable space_cv;
+
+    // Idle workers sleep here until there is a strand to run
+    std::mutex idle_lock;
+    std::condition_variable work_cv;
+    size_t runnable_count;
+    std::atomic<bool> stopping;
+
+    std::atomic<uint64_t> processed_count;
+    std::atomic<uint64_t> steal_count;
+    std::mutex stats_lock;
+    uint64_t stats_start_ms;
+    uint64_t stats_start_steals;
+    uint64_t stats_start_count;
+
+    Strand *GetStrand(std::string_view key);
+    void RunWorker(size_t index);
+    void Schedule(Strand *strand, size_t index);
+    Strand *TakeStrand(size_t index);
+    void ReportStats();
+};
+
+#endif // CHIPSIE_WORKER_POOL_HPP
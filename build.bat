@@ -1,10 +1,22 @@
 call vcvarsall.bat x86_amd64
 
-cl main.cpp ChatProcessing.cpp Database.cpp TwitchConn.cpp sqlite3.c^
- /O2 /W3 /EHsc^
+cl main.cpp ChatProcessing.cpp Database.cpp TwitchConn.cpp NetPlatform.cpp^
+ EventLoop.cpp IoEngine.cpp ReactorEngine.cpp RingBuffer.cpp Histogram.cpp^
+ Resolver.cpp TwitchLink.cpp IrcLine.cpp TlsSession.cpp SpscRing.cpp^
+ Wakeup.cpp WorkerPool.cpp ChatPipeline.cpp TimerWheel.cpp MotdEngine.cpp^
+ CmdRuntime.cpp SendWindow.cpp^
+ sqlite3.c^
+ /O2 /W3 /EHsc /std:c++20^
  /link ws2_32.lib /out:chipsie.exe
 
-::clang main.cpp ChatProcessing.cpp Database.cpp TwitchConn.cpp sqlite3.c^
- ::-O3 -o chipsie.exe -lws2_32
+::clang main.cpp ChatProcessing.cpp Database.cpp TwitchConn.cpp NetPlatform.cpp^
+ ::EventLoop.cpp IoEngine.cpp ReactorEngine.cpp RingBuffer.cpp Histogram.cpp^
+ ::Resolver.cpp TwitchLink.cpp IrcLine.cpp TlsSession.cpp SpscRing.cpp^
+ ::Wakeup.cpp WorkerPool.cpp ChatPipeline.cpp TimerWheel.cpp^
+ ::MotdEngine.cpp CmdRuntime.cpp SendWindow.cpp sqlite3.c^
+ ::-O3 -std=c++20 -o chipsie.exe -lws2_32
  
+:: TLS needs OpenSSL, add /DCHIPSIE_TLS and libssl.lib libcrypto.lib to the
+:: cl line above to build with it
+
 del *.obj
\ No newline at end of file
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Linux build. Uses the sqlite3 amalgamation if it sits next to the sources
+# (same as build.bat), otherwise links against the system libsqlite3.
+set -e
+
+SQLITE_LIB="-lsqlite3"
+if [ -f sqlite3.c ]; then
+    cc -c sqlite3.c -O2 -o sqlite3.o
+    SQLITE_LIB="sqlite3.o -ldl"
+fi
+
+# TLS support needs the OpenSSL headers and libraries
+TLS_FLAGS=""
+if echo '#include <openssl/ssl.h>' | c++ -E -x c++ - >/dev/null 2>&1; then
+    TLS_FLAGS="-DCHIPSIE_TLS -lssl -lcrypto"
+fi
+
+SOURCES="main.cpp ChatProcessing.cpp Database.cpp TwitchConn.cpp NetPlatform.cpp
+ EventLoop.cpp IoEngine.cpp ReactorEngine.cpp UringEngine.cpp RingBuffer.cpp
+ Histogram.cpp Resolver.cpp TwitchLink.cpp IrcLine.cpp TlsSession.cpp
+ SpscRing.cpp Wakeup.cpp WorkerPool.cpp ChatPipeline.cpp TimerWheel.cpp
+ MotdEngine.cpp CmdRuntime.cpp SendWindow.cpp"
+
+c++ $SOURCES \
+ -O2 -Wall -std=c++20 -pthread \
+ -o chipsie $SQLITE_LIB $TLS_FLAGS
+
+rm -f sqlite3.o
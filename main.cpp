@@ -24,36 +24,81 @@
  */
 
 #include "jsmn.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "NetPlatform.hpp"
 #include "TwitchConn.hpp"
 #include "ChatProcessing.hpp"
 #include "Database.hpp"
-#include <thread>
-#include <chrono>
+#include "EventLoop.hpp"
+#include "IoEngine.hpp"
+#include "ChatPipeline.hpp"
+#include "MotdEngine.hpp"
+#include "WorkerPool.hpp"
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 const char * const DEF_AUTH_CFG_FILE = "auth.json";
 const char * const DEF_DB_FILE = "chipsie.db"; 
+const char * const DEF_IRC_SERVER = "irc.chat.twitch.tv";
+const char * const DEF_IRC_PORT = "6667";
+const char * const DEF_IRC_TLS_PORT = "6697";
 
 static AuthData auth;
+static EventLoop net_loop; // Driven by the Twitch connection's own thread
+static EventLoop loop;
+static IoEngine *engine;
 static TwitchConn tc;
 static Database db;
+static ChatPipeline pipeline;
+static MotdEngine motd;
 
 // Loads the server authorization credentials from the auth file.
 bool LoadAuthCfg(const char *auth_cfg_file, AuthData *auth_data);
+// Twitch names are case insensitive and always lowercase on the wire
+static std::string ToLower(std::string name);
 
 // Main application entry point
 int main(const int argc, const char **argv) {
     printf("Chipsie the Twitch Chat Bot Starting Up...\n");
 
-    using namespace std;
-    using namespace std::chrono;
+    // "--engine uring" swaps the default reactor for io_uring on Linux,
+    // "--rx-budget <bytes>" caps how much is read per socket wakeup,
+    // "--workers <count>" sets how many threads process chat and
+    // "--share <channel>=<weight>" gives a channel more of the processing
+    // and sending when channels compete, it can be given more than once
+    const char *engine_name = "reactor";
+    long rx_budget = (long)IoEngine::DEFAULT_RECV_BUDGET;
+    int num_workers = WorkerPool::GetDefaultWorkers();
+    std::vector<std::pair<std::string, uint32_t> > shares;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            engine_name = argv[++i];
+        } else if (strcmp(argv[i], "--rx-budget") == 0 && i + 1 < argc) {
+            rx_budget = atol(argv[++i]);
+            if (rx_budget <= 0) {
+                rx_budget = (long)IoEngine::DEFAULT_RECV_BUDGET;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            num_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--share") == 0 && i + 1 < argc) {
+            const char *arg = argv[++i];
+            const char *eq = strchr(arg, '=');
+            int share = eq != NULL ? atoi(eq + 1) : 0;
+            if (eq == NULL || eq == arg || share <= 0) {
+                printf("WARNING: Ignored bad share %s\n", arg);
+                continue;
+            }
+            if (*arg == '#') arg++;
+            shares.emplace_back(ToLower(std::string(arg, eq - arg)), 
+                (uint32_t)share);
+        }
+    }
 
-#ifdef _WIN32
-    // Initialize windows sockets
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2,2), &wsaData);
-#endif // _WIN32
+    if (!NetStartup()) return -1;
 
     if (!LoadAuthCfg(DEF_AUTH_CFG_FILE, &auth)) return -1;
     printf("Loaded credentials...\n");
@@ -61,36 +106,55 @@ int main(const int argc, const char **argv) {
     if (!db.Init(DEF_DB_FILE)) return -1;
     printf("Database Initialized...\n");
 
-    if (tc.Init(auth) == TWC_ERROR) return -1;
+    if (!loop.Init() || !net_loop.Init()) return -1;
+    engine = CreateIoEngine(engine_name, &net_loop);
+    engine->SetRecvBudget((size_t)rx_budget);
+    printf("Using %s I/O engine...\n", engine->GetName());
+    if (tc.Init(auth, &net_loop, engine) == TWC_ERROR) return -1;
+    for (size_t i = 0; i < shares.size(); i++) {
+        tc.SetChannelShare(shares[i].first, shares[i].second);
+    }
+    if (!tc.Start(&loop)) return -1;
     printf("Twitch connection initialized...\n");
 
+    if (!motd.Init(&db, &tc, &loop, auth.channel)) return -1;
+    if (!pipeline.Start(&tc, &db, &motd, &loop, num_workers)) return -1;
+    for (size_t i = 0; i < shares.size(); i++) {
+        pipeline.SetChannelShare(shares[i].first, shares[i].second);
+    }
+    printf("Processing chat on %d workers...\n", pipeline.GetNumWorkers());
+
     printf("Chipsie is now running :D\n\n");
     while (true) {
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        tc.Update();
         if (tc.GetConnectionStatus() == TWC_ERROR) break;
 
+        // Blocks until the network thread hands over chat or a timer is due
+        loop.RunOnce();
+
         while (tc.GetNumRxMsgs() > 0) {
-            ProcessChatLine(tc.GetNextRxMsg(), &tc, &db);
+            uint64_t arrival_us = 0;
+            std::string_view line = tc.GetNextRxMsg(&arrival_us);
+            pipeline.Submit(line, arrival_us);
         }
-
-        auto elapsed = high_resolution_clock::now() - start_time;
-        auto ticks = duration_cast<microseconds>(elapsed).count();
-        if (ticks > 33000) ticks = 33000;
-        std::this_thread::sleep_for(microseconds(33000 - ticks));
+        pipeline.Flush();
     }
 
+    pipeline.Shutdown();
+    motd.Shutdown();
     tc.Shutdown();
+    engine->Shutdown();
+    delete engine;
+    net_loop.Shutdown();
+    loop.Shutdown();
+    NetCleanup();
     printf("Chipsie the Twitch Chat Bot Shutting Down...Bye Bye!\n");
     return 0;
 }
 
 bool LoadAuthCfg(const char *auth_cfg_file, AuthData *auth_data)
 {
-    FILE *auth_file = NULL;
-    errno_t res = fopen_s(&auth_file, auth_cfg_file, "rb");
-    if (res) {
+    FILE *auth_file = fopen(auth_cfg_file, "rb");
+    if (auth_file == NULL) {
         printf("Failed to open auth config file\n");
         return false;
     }
@@ -107,10 +171,10 @@ bool LoadAuthCfg(const char *auth_cfg_file, AuthData *auth_data)
     int rc = (int)fread(file_str, 1, file_len, auth_file);
     fclose(auth_file);
 
-    jsmntok tokens[12];
+    jsmntok tokens[32];
     jsmn_parser parser;
     jsmn_init(&parser);
-    rc = jsmn_parse(&parser, file_str, (size_t)file_len, tokens, 12);
+    rc = jsmn_parse(&parser, file_str, (size_t)file_len, tokens, 32);
     if (rc <= 0) {
         printf("Too few JSON tokens in auth file\n");
         free(file_str);
@@ -121,6 +185,10 @@ bool LoadAuthCfg(const char *auth_cfg_file, AuthData *auth_data)
     bool got_client_id = false;
     bool got_nick = false;
     bool got_channel = false;
+    auth_data->server = DEF_IRC_SERVER;
+    auth_data->port = "";
+    auth_data->use_tls = false;
+    auth_data->ca_file = "";
     int tok_it = 0;
     while (tok_it < rc) {
         std::string key = std::string(&file_str[tokens[tok_it].start], 
@@ -146,15 +214,45 @@ bool LoadAuthCfg(const char *auth_cfg_file, AuthData *auth_data)
             auth_data->channel = std::string(&file_str[tokens[tok_it].start], 
                 tokens[tok_it].end - tokens[tok_it].start);
             if (auth_data->channel.length() > 0) got_channel = true;
+        } else if (key == "server") { // Optional, e.g. a local test server
+            tok_it++;
+            auth_data->server = std::string(&file_str[tokens[tok_it].start], 
+                tokens[tok_it].end - tokens[tok_it].start);
+        } else if (key == "port") { // Optional
+            tok_it++;
+            auth_data->port = std::string(&file_str[tokens[tok_it].start], 
+                tokens[tok_it].end - tokens[tok_it].start);
+        } else if (key == "tls") { // Optional, true to use port 6697
+            tok_it++;
+            std::string value = std::string(&file_str[tokens[tok_it].start],
+                tokens[tok_it].end - tokens[tok_it].start);
+            auth_data->use_tls = value == "true";
+        } else if (key == "ca_file") { // Optional, to trust a test cert
+            tok_it++;
+            auth_data->ca_file = std::string(&file_str[tokens[tok_it].start], 
+                tokens[tok_it].end - tokens[tok_it].start);
         }
         tok_it++;
     }
 
     free(file_str);
+    // E.g. the JOIN echo only matches the nick once both are lowercase
+    auth_data->nick = ToLower(auth_data->nick);
+    auth_data->channel = ToLower(auth_data->channel);
+    if (auth_data->port.empty()) {
+        auth_data->port = auth_data->use_tls ? DEF_IRC_TLS_PORT : DEF_IRC_PORT;
+    }
     if (got_oauth && got_client_id && got_nick && got_channel) {
         return true;
     } else {
         printf("ERROR: Invalid credentials in auth file\n");
     }
     return false;
-}
\ No newline at end of file
+}
+
+static std::string ToLower(std::string name) {
+    for (size_t i = 0; i < name.size(); i++) {
+        name[i] = (char)tolower((unsigned char)name[i]);
+    }
+    return name;
+}